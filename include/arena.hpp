@@ -0,0 +1,42 @@
+// RequestArena, a per-thread bump allocator for the nodes one request's render makes
+// A [@on dynamo] page is rendered once per HTTP request, and every render clones the page's resident tree, loads the templates it looks up onto
+// that clone, and builds the request object: thousands of little Node allocations that all die together when the render's done. While a thread
+// is inside enter()/leave(), Node's operator new takes them from this thread's arena instead of the heap, operator delete doesn't bother handing
+// them back, and leave() rewinds the whole thing in one go. (What the nodes themselves allocate, like their strings and child lists, is still
+// ordinary heap memory, and their destructors still free it.)
+// Anything that has to outlive the request must be allocated outside the arena; ParseCache::put does that with suspend()/resume().
+#pragma once
+#include <cstddef>
+#include <vector>
+
+
+struct RequestArena {
+    size_t blockSize = 64 * 1024;
+    size_t keepBytes = 1024 * 1024; // leave() frees blocks past this much, so one huge page doesn't pin its memory forever
+    std::vector<char*> blocks;
+    std::vector<size_t> sizes; // how big each block is (usually blockSize, but an allocation bigger than that gets a block of its own)
+    size_t block = 0; // the block we're allocating from
+    size_t used = 0; // how far into it we are
+    int depth = 0; // enter()s without a leave() yet
+    bool suspended = false;
+
+    static RequestArena* current(); // this thread's arena if it's in use (entered and not suspended), NULL otherwise
+
+    static void enter(); // start allocating nodes from this thread's arena. Nests.
+
+    static void leave(); // rewind the arena, once the outermost enter() is left. Everything allocated since is gone, so it had better all be deleted.
+
+    static void suspend(); // allocate from the heap for a bit, for things that outlive the request
+
+    static void resume();
+
+    static bool holds(void* ptr); // is ptr from this thread's arena (entered, suspended or not)? operator delete leaves those alone.
+
+    void* alloc(size_t size);
+
+    bool owns(void* ptr);
+
+    void rewind();
+
+    ~RequestArena();
+};
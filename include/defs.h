@@ -1,5 +1,8 @@
 #pragma once
 #include <vector>
+#include <cstddef>
+
+#define SITIX_VERSION "2.1"
 
 #define INFO      "\033[32m[   INFO   ]\033[0m "
 #define ERROR   "\033[1;31m[   ERROR  ]\033[0m "
@@ -22,6 +25,8 @@ struct FileFlags; // (which makes builds faster)
 struct MapView; // ideally this file will be changed far less frequently than the other headers
 struct FileWriteOutput;
 struct StringWriteOutput;
+struct WriteBehind;
+struct OutputFile;
 struct SitixWriter;
 struct Node;
 class Session;
@@ -0,0 +1,296 @@
+// Dynamo, Sitix's built-in HTTP server (--serve)
+// One epoll loop per worker (--serve-threads of them, each pinned to its own core when there's more than one), every socket non-blocking. Each
+// worker has its own SO_REUSEPORT listener, so the kernel spreads connections between them and a connection never changes workers. It serves the
+// output directory over HTTP/1.1 with keep-alive (and pipelining, since that falls out of handling requests in order), answers GET and HEAD, and
+// does conditional requests with ETags and If-Modified-Since.
+// Small files are kept in memory (under cacheBytes, least recently used out first), so the hot path for a page is a hash lookup and one writev;
+// anything bigger goes out with sendfile straight from the page cache. Nothing in the cache is ever stat'ed again: in watch mode, main() tells us
+// which outputs each rebuild touched with invalidate().
+// The cache is shared by every worker, RCU style: a DynamoCache is never changed once it's published, workers read whichever one was current when
+// they last looked (without locking anything unless a new one's come out since), and changes (files loaded, renders finished, invalidations) are
+// queued up and published together as a new copy. Whoever's still using the old one keeps it alive until they're done with it. The cache is split
+// into shards by path, and a new generation only copies the shards its changes touch. Copying happens outside the lock, by one worker at a time,
+// which takes every worker's queued changes with it; workers with changes while it's busy just leave them for it. Every invalidation
+// gets an epoch, and anything read or rendered before the latest invalidation of its path is thrown away rather than published, so a slow render
+// of the old version can't land on top of the new one.
+// Dotfiles (like .sitix and .sitix-manifest) and anything with a .. in it are never served.
+// With --on-demand, root is the site directory instead, and nothing's rendered until somebody asks for it: a Sitix page is rendered into memory on
+// the render pool (through renderer), cached like any other small file, and dropped again when the watcher says it or anything it looked up has
+// changed. Requests for a page that's already being rendered (by the same worker) wait for that render instead of starting another.
+// Renders for requests have their own pool, and only hold the session shared, so a rebuild never holds them up (and they never hold it up).
+// Pages marked [@on dynamo] are the exception to all that caching: they're rendered on the pool for every request, with the request's method, path,
+// query and headers in scope, and the result goes to that request alone (with Cache-Control: no-store). That works with or without --on-demand;
+// without it, the build tells us which outputs came from dynamo pages (through mark()) and those are rendered instead of served from disc.
+// An HTTP/1.1 GET for a dynamo page doesn't wait for the render to finish: it's rendered into a ChunkedWriteOutput, which hands the loop a chunk
+// (Transfer-Encoding: chunked) every flushBytes bytes or flushMillis milliseconds, so the top of the page is on its way while the rest is still
+// being rendered. The render never waits for the client (it holds the session while it runs): chunks pile up in the stream until the loop can send
+// them, a client that doesn't read anything for idleTimeout seconds is closed like any other idle one, and one that falls maxStreamed bytes behind
+// is cut off.
+#pragma once
+#include <string>
+#include <vector>
+#include <deque>
+#include <memory>
+#include <unordered_map>
+#include <unordered_set>
+#include <thread>
+#include <functional>
+#include <mutex>
+#include <ctime>
+#include <sys/types.h>
+#include <defs.h>
+#include <threadpool.hpp>
+#include <sitixwriter.hpp>
+#include <atomic>
+#include <chrono>
+#include <array>
+
+
+struct DynamoFile { // a small file, held in memory
+    std::shared_ptr<const std::string> body; // shared, so a response that's halfway out the door keeps it alive if it's invalidated or evicted
+    std::string etag;
+    std::string lastModified;
+    time_t mtime;
+    const char* type;
+    std::atomic<time_t> used = 0; // when it was last served, for eviction. (The only thing about a published file that ever changes.)
+};
+
+
+struct DynamoShard { // the paths in a DynamoCache that hash to one slot. Never changed once it's published, either.
+    std::unordered_map<std::string, std::shared_ptr<DynamoFile>> files; // by path relative to root
+    std::unordered_set<std::string> dynamic; // paths of dynamo pages, which are rendered for every request
+};
+
+
+struct DynamoCache { // one generation of what's in memory. Never changed once it's published.
+    static const size_t Shards = 64;
+    std::array<std::shared_ptr<const DynamoShard>, Shards> shards; // shared with the generations before and after, except where they differ
+    size_t bytes = 0; // the size of every body in every shard
+
+    DynamoCache(); // every shard empty
+
+    static size_t shardOf(const std::string& path);
+
+    const DynamoShard& shard(const std::string& path) const;
+};
+
+
+struct DynamoChange { // something for the next DynamoCache
+    enum Kind {
+        Store, // put file in at path (unless path was invalidated after since)
+        Drop, // take path out
+        Dynamic, // path is a dynamo page
+        Static // path isn't
+    } kind;
+    std::string path;
+    std::shared_ptr<DynamoFile> file;
+    uint64_t since = 0; // the invalidation epoch when file started being read or rendered
+};
+
+
+struct DynamoConnection;
+
+
+struct DynamoStream { // a dynamo page's response, going out while it's still being rendered. Shared by the render and the connection.
+    std::mutex m_mutex;
+    std::deque<std::string> chunks; // framed, and waiting for the loop to take them
+    size_t queued = 0; // bytes in chunks, plus the one the loop's sending now
+    bool done = false; // the render's finished, and everything it made is in chunks
+    bool failed = false; // ...but it didn't render anything (it's a template, or it's gone)
+    std::atomic<bool> cancelled = false; // the client went away (or stopped reading), so there's no point rendering any more of it
+    DynamoConnection* connection = NULL; // who it's for. Only the loop touches this, and it's NULL once the response is over.
+    const char* type = NULL; // Content-Type
+    bool started = false; // the loop's sent the head. Loop only, too.
+};
+
+
+struct DynamoConnection {
+    int fd;
+    std::string in; // received, but not handled yet (a partial request, or pipelined ones)
+    std::string head; // response headers that haven't been sent yet
+    std::shared_ptr<const std::string> body; // response body from memory, if there is one
+    size_t sent = 0; // how much of head, then body, has gone out
+    int file = -1; // response body to sendfile, if it's too big for the cache
+    off_t offset = 0; // how far into file we've sent
+    off_t length = 0; // where file ends
+    bool keepAlive = true; // the response we're sending doesn't end the connection
+    bool headOnly = false; // the request being answered is a HEAD, so the response has no body
+    bool chunkable = false; // the request being answered is HTTP/1.1, so the response can be chunked
+    std::shared_ptr<DynamoStream> stream; // the response is a dynamo page being streamed, and whatever's in head and body is its latest piece
+    size_t pulled = 0; // how big that piece is, so the stream can be told when it's out
+    std::string awaiting; // the page whose render this connection is waiting on (--on-demand), if any
+    time_t active; // last time anything happened, for closing idle keep-alives
+};
+
+
+struct DynamoRequest { // what a dynamo page gets to see of the request it's answering
+    std::string method;
+    std::string path; // decoded, without the query
+    std::vector<std::pair<std::string, std::string>> query; // decoded name/value pairs, in the order they were sent
+    std::unordered_map<std::string, std::string> headers; // names in lowercase
+};
+
+
+struct DynamoWaiter { // a request that's waiting on a render
+    DynamoConnection* connection;
+    DynamoRequest request; // what it asked for: the headers for If-None-Match and friends once the page exists, and all of it for dynamo pages
+};
+
+
+struct DynamoRender { // a finished render, on its way back from the pool
+    std::string key; // what it's waiting under in rendering: the path, or a one-off name for a dynamo page's render for a single request
+    std::string path;
+    uint64_t since; // the invalidation epoch when it started
+    bool ok; // false if it's a template or couldn't be read
+    bool dynamic = false; // it's a dynamo page, rendered for one request, so it mustn't be cached
+    std::string body; // (empty if it was streamed)
+};
+
+
+struct Dynamo;
+
+
+struct DynamoWorker { // one event loop, with its own listener and connections
+    Dynamo* server;
+    int core = -1; // what it's pinned to, if anything
+    int listener = -1;
+    int epoll = -1;
+    int wakeup = -1; // an eventfd, poked by the render pool (and by invalidate() and mark(), for the first worker)
+    std::thread thread;
+    std::vector<DynamoConnection*> connections; // indexed by fd
+    std::shared_ptr<const DynamoCache> cache; // the generation this worker's reading
+    uint64_t generation = 0; // ...and its number
+    std::unordered_map<std::string, std::shared_ptr<DynamoFile>> unpublished; // what we've loaded or rendered since we last published
+    std::unordered_map<std::string, bool> unpublishedDynamic; // pages we've found out are (or aren't) dynamo pages since then
+    std::vector<DynamoChange> changes; // ...and everything else this worker's changed. Both go to the server once per loop.
+    std::unordered_map<std::string, std::vector<DynamoWaiter>> rendering; // pages on the pool, and who's waiting for them
+    size_t oneOffs = 0; // for naming dynamo pages' renders in rendering
+    std::mutex m_mutex;
+    std::vector<DynamoRender> finished; // renders the loop hasn't picked up yet. Guarded by m_mutex.
+    std::vector<std::shared_ptr<DynamoStream>> flowing; // streams with something new for the loop. Also guarded by m_mutex.
+    time_t now = 0; // the loop's clock, updated once per wakeup
+    std::string date; // the Date header for now
+
+    bool start(); // bind and listen. Complains and returns false if it can't.
+
+    void run(); // the event loop. Never returns.
+
+    void poke(); // wake the loop up. Safe from any thread.
+
+    void view(); // catch up with the server's latest cache, if there's a newer one than ours
+
+    void publish(); // hand changes and unpublished to the server
+
+    void wake(); // pick up finished renders and streams that have more to send
+
+    void accept();
+
+    void receive(DynamoConnection* connection); // read everything that's there, then handle whatever requests are complete
+
+    bool send(DynamoConnection* connection); // push out as much of the response as the socket takes, then move on to the next request if there's
+    // one waiting. Returns false when the connection should be closed.
+
+    bool handle(DynamoConnection* connection); // if there's a complete request in connection -> in, consume it and set up the response.
+    // Returns false if there wasn't one.
+
+    void respond(DynamoConnection* connection, std::string method, std::string target, std::unordered_map<std::string, std::string>& headers);
+
+    DynamoFile* find(std::string& path); // path's file, from what we've got unpublished or else the cache. NULL if it isn't in memory.
+
+    bool isDynamic(std::string& path);
+
+    bool reply(DynamoConnection* connection, std::string etag, std::string lastModified, time_t mtime, const char* type, size_t size,
+        std::unordered_map<std::string, std::string>& headers); // fill in the response headers: a 200, or a 304 if headers say the client
+    // already has it. Returns whether a body should follow.
+
+    void serve(DynamoConnection* connection, DynamoFile* file, std::unordered_map<std::string, std::string>& headers); // respond with a cached file
+
+    void status(DynamoConnection* connection, int code, std::string extra = ""); // a response with a little HTML body explaining code
+
+    void render(DynamoConnection* connection, std::string path, DynamoRequest& request); // wait for path to be rendered, starting the render if
+    // nobody else is waiting for it already
+
+    void renderFor(DynamoConnection* connection, std::string path, DynamoRequest& request); // render the dynamo page at path for this request alone
+
+    void submit(std::string key, std::string path, DynamoRequest& request, std::shared_ptr<DynamoStream> stream = NULL); // put a render on the
+    // pool. With a stream, it's rendered into that rather than into a DynamoRender's body.
+
+    int pull(DynamoConnection* connection); // take the next piece of a streamed response: 1 if there was one, 0 if the render hasn't made any more
+    // yet, -1 if the response is over and -2 if it has to be cut off
+
+    void finish(DynamoRender& render); // cache a render and answer everyone who was waiting for it
+
+    void fresh(DynamoConnection* connection, std::string& body, const char* type); // respond with a dynamo page's render, which is never cached
+
+    DynamoFile* load(std::string path, struct stat& sb, int fd, uint64_t since); // read a small file into the cache
+
+    DynamoFile* store(std::string path, std::string&& content, std::string etag, time_t mtime, uint64_t since); // put something in the cache
+
+    void close(DynamoConnection* connection);
+
+    void tick(); // update now and date, and close connections that have been idle too long
+};
+
+
+struct Dynamo {
+    std::string address = "127.0.0.1"; // --bind
+    int port = 8080; // --serve
+    size_t workerCount = 1; // --serve-threads. 0 means one per core.
+    std::string root; // the directory being served
+    size_t cacheBytes = 64 * 1024 * 1024; // how much file content to keep in memory
+    size_t maxCachedFile = 256 * 1024; // files bigger than this are always sendfile'd
+    size_t maxHeader = 16 * 1024; // requests with more header than this get a 431
+    int idleTimeout = 60; // seconds an idle keep-alive connection is kept open
+    size_t flushBytes = 16 * 1024; // a streamed page sends a chunk once it has this much (--flush-kb)...
+    int flushMillis = 20; // ...or once what it has is this old (--flush-ms)
+    size_t maxStreamed = 64 * 1024 * 1024; // how much of a streamed page can be waiting on the client before we give up on it
+
+    bool onDemand = false; // root is the site directory, and Sitix files in it are pages to render (--on-demand)
+    std::function<bool(std::string path, DynamoRequest& request, WriteOutput& out, bool& dynamic)> renderer; // render the page at path (relative
+    // to the site directory) into out, setting dynamic if it's a dynamo page (in which case request is in scope). Runs on pool.
+    std::function<void(std::string path)> watch; // --on-demand: path is about to be served, so changes to it have to be noticed from now on
+    ThreadPool pool; // renders for requests (not the watch loop's pool: a rebuild waits for its pool to empty, and shouldn't wait on these)
+
+    std::vector<DynamoWorker*> workers;
+    std::thread worker; // runs run(), when the main thread's busy with the watch loop
+    std::mutex m_mutex;
+    std::shared_ptr<const DynamoCache> published = std::make_shared<const DynamoCache>(); // the latest cache. Guarded by m_mutex.
+    std::atomic<uint64_t> generation = 0; // bumped with every publish, so workers can tell they're behind without taking m_mutex
+    std::atomic<uint64_t> epoch = 0; // bumped with every invalidate()
+    std::unordered_map<std::string, uint64_t> invalidatedAt; // the epoch each path was last invalidated in. Guarded by m_mutex.
+    std::vector<DynamoChange> pending; // changes that haven't been published yet, from everyone. Also guarded by m_mutex.
+    bool publishing = false; // somebody's building the next generation (and will pick up pending when they're done). Also guarded by m_mutex.
+
+    bool start(); // set up every worker. Complains and returns false if they can't all listen.
+
+    void run(); // start the workers' loops. Never returns.
+
+    void invalidate(std::string path); // path (relative to root) has changed or is gone. Safe from any thread.
+
+    void mark(std::string path, bool isDynamic); // path (relative to root) was just built from a page that is (or isn't) a dynamo page. Safe from
+    // any thread, and before start().
+
+    void publish(std::vector<DynamoChange>& changes); // queue changes (clearing it), and unless someone else already is, make new caches with
+    // everything pending applied and swap them in until there's nothing left pending
+
+    static std::vector<std::pair<std::string, std::string>> parseQuery(std::string query); // split and decode an application/x-www-form-urlencoded
+    // query string
+};
+
+
+struct ChunkedWriteOutput : WriteOutput { // a dynamo page's render, on its way to the client as it's made (HTTP/1.1 chunked transfer encoding)
+    Dynamo* server;
+    DynamoWorker* worker; // the loop the client's on
+    std::shared_ptr<DynamoStream> stream;
+    std::string buffer; // what hasn't been made into a chunk yet
+    std::chrono::steady_clock::time_point since; // when the first byte in buffer was written
+
+    ChunkedWriteOutput(DynamoWorker* loop, std::shared_ptr<DynamoStream> to);
+
+    void write(const char* data, size_t length); // buffer, and flush at server's thresholds
+
+    void flush(bool last = false); // send whatever's buffered as a chunk (and with last, the terminating chunk after it). Cancels the stream,
+    // rather than waiting, if too much is already queued for the client
+
+    void finish(bool ok); // the render's over. If it didn't work and nothing's been sent yet, the client gets a 404.
+};
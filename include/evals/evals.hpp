@@ -23,4 +23,6 @@ struct EvalsBlob : Node {
     EvalsBlob(Session*, MapView d);
 
     void render(SitixWriter* out, Object* scope, bool dereference);
+
+    Node* clone();
 };
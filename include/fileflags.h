@@ -6,7 +6,7 @@ struct FileFlags {
     bool sitix = true; // what does this do? perhaps we'll never know
     // I'm too scared to remove it and too lazy to figure it out
     // #cruft
-    bool dynamo = false; // Sitix Dynamo
-    // it's a Watchdog extension that allows you to make pages that get re-rendered in the same Lua context rather than cold-rendered
-    // (it still cold-renders sitix, so watchdog is not useful without Lua mode)
+    bool dynamo = false; // Sitix Dynamo ([@on dynamo])
+    // the page is rendered again for every request the server (--serve) gets for it, from a parse that's kept resident rather than cold-rendered,
+    // with a request object (request.query.id, request.headers.host...) in scope
 };
@@ -0,0 +1,59 @@
+// FileIndex, an in-memory picture of the input tree
+// The initial FTS walk in main() already stats every path in the input directory, so rather than throwing that away and then stat'ing (and opendir'ing)
+// the same paths again every time a root-scope lookup happens, we keep what the walk found here. In watchdog mode the TreeWatcher keeps it current.
+// Everything is keyed by path relative to the indexed directory; the directory itself is "".
+#pragma once
+#include <string>
+#include <vector>
+#include <unordered_map>
+#include <sys/stat.h>
+#include <defs.h>
+#include <fileman.hpp>
+#include <iouring.hpp>
+
+
+struct IndexedPath {
+    FileMan::PathState type = FileMan::PathState::CNEP;
+    off_t size = 0;
+    struct timespec mtime = {0, 0};
+    std::vector<std::string> children; // names (not paths!) of everything in this directory, in sorted order. Always empty for files.
+};
+
+
+struct FileIndex {
+    std::string dir; // the directory being indexed (same as the input FileMan's dir)
+    std::unordered_map<std::string, IndexedPath> paths;
+    bool ready = false; // set after the initial scan. Until then nothing is authoritative and every query falls through to the filesystem.
+
+    FileIndex(std::string rdir);
+
+    std::string relative(std::string path); // turn a path as FTS or TreeWatcher see it (prefixed with dir) into a normalized index key
+
+    std::string absolute(std::string key); // and back again
+
+    static bool normalize(std::string& path); // clean up a relative path in-place. Returns false if the path can't be answered from the index (it has ..)
+
+    void scan(std::string path, std::vector<std::string>* files = NULL, std::vector<std::string>* dirs = NULL); // FTS walk path (prefixed with dir),
+    // indexing everything under it. The full paths of every regular file and directory found are appended to files and dirs, if they aren't NULL.
+    // With --io-uring it walks with scanBatched instead, which finds the same things in the same order.
+
+    void scanBatched(IoUring& ring, std::string path, std::vector<std::string>* files, std::vector<std::string>* dirs); // readdir each directory and
+    // statx all its entries in one ring submission, then recurse. path must be a directory that's already been inserted.
+
+    void insert(std::string key, const struct stat* sb); // add or update a single entry, and link it into its parent directory
+
+    void refresh(std::string path); // re-stat a path (prefixed with dir) after a filesystem event. If it's a new directory, its contents are scanned too.
+
+    void remove(std::string path); // drop a path (prefixed with dir) and everything under it
+
+    void resync(std::vector<std::string>& files, std::vector<std::string>& dirs, std::vector<std::string>& removed); // compare everything against the disc,
+    // for when the watcher has lost track. Files that are new or changed go in files, new directories in dirs, and everything that's gone (files and
+    // directories, children before their parents) in removed; all of them prefixed with dir. Only directories whose mtime moved are read again.
+
+    IndexedPath* find(std::string key); // NULL if the key isn't indexed
+
+    bool checkPath(std::string key, FileMan::PathState& out); // same semantics as FileMan::checkPath, but from memory.
+    // Returns false if the index can't answer (not ready, the key has .. in it, or it's a symlink that needs following), in which case stat it.
+
+    bool children(std::string key, std::vector<std::string>& out); // fills out with the sorted entries of a directory. Returns false if the index can't answer.
+};
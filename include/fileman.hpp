@@ -1,15 +1,41 @@
 /* By Tyler Clarke
     Fileman is a class that pulls SitixWriter and MapView all together. It manages the output directory and reads from the input directory.
 */
+#pragma once
 #include <string>
 #include <defs.h>
-#include <map>
+#include <unordered_map>
+#include <list>
+#include <vector>
+#include <thread>
+#include <mutex>
+#include <sys/stat.h>
 #include <mapview.hpp>
 #include <util.hpp>
+#include <writebehind.hpp>
+
+
+struct CachedMap { // an entry in FileMan's mmap cache
+    MapView view;
+    dev_t device; // device, inode, mtime and size together decide whether the file on disc is still the one we mapped
+    ino_t inode;
+    struct timespec mtime;
+    off_t size;
+    std::list<std::string>::iterator age; // where this entry sits in the LRU list
+};
 
 
 class FileMan {
-    std::map<std::string, MapView> maps;
+    std::unordered_map<std::string, CachedMap> maps;
+    std::list<std::string> lru; // most recently used at the front
+    size_t cachedBytes = 0;
+    ReadArena arena; // small files get read into this instead of mapped
+    std::mutex cacheMutex; // watch mode renders on several threads at once, and they all go through the same cache. Guards the maps and the
+    // LRU only: files are loaded outside it (the arena has its own lock)
+
+    void evict(); // drop least-recently-used maps until we're back under budget
+
+    void drop(std::string path); // uncache, for when cacheMutex is already held
 
 public:
     enum PathState {
@@ -23,6 +49,8 @@ public:
 
     PathState checkPath(std::string path);
 
+    std::vector<std::string> listDirectory(std::string path); // readdir a directory (relative to this FileMan), returning the names in sorted order
+
     std::string transmuted(std::string path); // like old transmuted but less awful
 
     std::string arcTransmuted(std::string path); // strip off this directory from a path (returning something relative to this directory), if possible
@@ -31,20 +59,59 @@ public:
 
     bool valid = true; // set to false by the FileMan if there's an error
 
+    size_t cacheBytes = 512 * 1024 * 1024; // budget for the mmap cache. Views handed out stay valid after eviction (they're reference counted),
+    size_t cacheFiles = 8192; // the cache just stops holding on to them.
+    size_t readThreshold = 16 * 1024; // files smaller than this are read() rather than mmap()ed; below a few pages the mapping costs more than the copy
+
     std::string dir;
 
+    WriteBehind writer; // everything create()d is written in the background through this
+
     FileMan(std::string rdir); // construct the FileMan to manage the directory referenced by rdir.
+    // if rdir ends in .tar, .tar.gz or .tgz, it's an archive instead of a directory, and everything is written into that.
 
     bool empty(bool); // empty the controlled directory and add the .sitix file (it will provide a warning prompt if .sitix doesn't exist)
     // returns whether or not it the directory was emptied.
 
+    bool update(bool); // get ready for an incremental build: if the last build left a manifest, keep everything and only replace what changes.
+    // Otherwise, empty() it (same prompt, same return). Either way, the writer's manifest is enabled afterwards.
+
+    void markManaged(); // (re)write the .sitix file
+
+    bool confirm(bool y); // check that the directory is ours to replace: it has a .sitix file, or y is set, or the user says so when prompted
+
+    std::string live; // when staging, the directory the site is served from. dir is then a sibling staging directory until swap().
+    std::thread reclaimer; // deletes retired generations
+
+    bool stage(bool y); // like update(), but build into a fresh staging directory next to this one. The live directory is left alone (except that
+    // unchanged outputs are hardlinked out of it) until swap(). Returns false if the user said no, or the staging directory can't be made.
+
+    bool swap(); // atomically exchange the finished staging directory with the live one, point this FileMan at the live one, and start deleting
+    // the old generation in the background
+
+    void reclaim(); // reclaimer body: delete every retired generation next to live
+
+    bool isArchive(); // is this an archive (a .tar, see TarWriter) rather than a directory?
+
+    bool closeArchive(); // finish the archive, once everything's been drained into it. Complains and returns false if anything went wrong with it.
+
+    ~FileMan();
+
     FileWriteOutput create(std::string where); // create a file and all of its parent directories, and return the filewriteoutput
     // that controls it. That filewriteoutput can be handed off to a SitixWriter for minification + markdown or can just be used raw.
+    // The actual creating and writing happens on the writer thread; call writer.drain() to wait for it and collect any errors.
+
+    void copy(std::string from, std::string where); // copy the file at from (a full path) to where in this directory, kernel-side and in the background
+
+    bool isPassthrough(std::string path); // sniff the header of a file (a full path): true if it's not Sitix and can just be copied
+
+    void remove(std::string where); // delete a file in this directory (also on the writer thread, so it stays ordered with create())
 
-    MapView open(std::string thing); // memory map a file into the buffer-like MapView, returning an invalid
+    MapView open(std::string thing); // load a file into the buffer-like MapView, returning an invalid
     // mapview if it doesn't exist (you MUST always check if mapview.isValid()!)
+    // small files are read into the arena, big ones are memory mapped (see readThreshold)
 
     // open() will recycle MapViews; it checks if the file is already mapped before mapping it. Because running stat, running open, *and* running mmap in sequence is
-    // slow ("heavy-hitter" system calls), the overhead from searching through an std::map of memory maps should still be an improvement.
-    // (also it lets me joke about a map of maps)
+    // slow ("heavy-hitter" system calls), a stat and a hash lookup on a hit is still an improvement.
+    // (it used to be an std::map, which let me joke about a map of maps. I miss that joke.)
 };
\ No newline at end of file
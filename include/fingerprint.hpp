@@ -0,0 +1,52 @@
+// Fingerprinter, which gives passthrough assets content-hashed names (css/site.css becomes css/site.1f2e3d4c.css) for cache-busting
+// Templates get at the hashed name with a root-scope lookup, [^assets.css/site\.css], so pages point straight at it while they render and nothing
+// has to go back over the output afterwards. Assets are hashed lazily, the first time either a page asks for one or the render queue reaches it,
+// and the result is kept until the file changes. At the end of a build the whole mapping goes into assets.json, with an ETag for each file,
+// so a server can hand out `Cache-Control: immutable` for the hashed names and still revalidate the plain ones.
+#pragma once
+#include <string>
+#include <map>
+#include <unordered_set>
+#include <mutex>
+#include <ctime>
+#include <sys/types.h>
+#include <defs.h>
+#include <fileman.hpp>
+
+
+struct Fingerprint {
+    uint64_t hash = 0;
+    std::string name; // the fingerprinted path, relative like the key
+    std::string published; // the fingerprinted name that's actually been written to the output, if any
+    dev_t device = 0; // what the file looked like when we hashed it, so we know when to hash it again
+    ino_t inode = 0;
+    off_t size = 0;
+    struct timespec mtime = {0, 0};
+};
+
+
+struct Fingerprinter {
+    bool enabled = false;
+    std::unordered_set<std::string> extensions { "css", "js", "mjs", "png", "jpg", "jpeg", "gif", "webp", "avif", "svg", "ico", "woff", "woff2", "ttf" };
+    std::string manifestName = "assets.json"; // where the mapping goes in the output
+    FileMan* input;
+    std::map<std::string, Fingerprint> assets; // keyed by path relative to the input directory. Ordered, so assets.json comes out sorted.
+    bool dirty = false; // has anything been published since the last assets.json?
+    std::mutex m_mutex;
+
+    Fingerprinter(FileMan* in);
+
+    bool wants(std::string key); // is fingerprinting on, and does key have one of the extensions?
+
+    bool resolve(std::string key, std::string& name); // fills name with the fingerprinted path for key, hashing the file if it's new or changed.
+    // If key isn't fingerprinted (wrong extension, not a passthrough file, or fingerprinting is off), name is just key. Returns false if key can't be read.
+
+    std::string publish(std::string key, std::string name); // record that name has been written for key. Returns the name it replaces ("" if none),
+    // which the caller should remove from the output.
+
+    std::string forget(std::string key); // key was deleted. Returns its published name ("" if none).
+
+    std::string json(); // the contents of assets.json
+
+    static std::string fingerprinted(std::string path, uint64_t hash); // splice the first 8 hex digits of hash in before the extension
+};
@@ -0,0 +1,26 @@
+// Hasher, a streaming XXH64
+// Used to fingerprint outputs as they're written, so the next build can tell whether a page actually changed. It isn't cryptographic and isn't meant
+// to be; it just has to be fast enough to not show up next to the writes, and spread well enough that two different pages never collide in practice.
+#pragma once
+#include <cstdint>
+#include <cstddef>
+#include <string>
+
+
+struct Hasher {
+    uint64_t acc[4];
+    unsigned char pending[32]; // bytes that haven't made up a full 32-byte stripe yet
+    size_t pendingSize = 0;
+    uint64_t total = 0;
+    uint64_t seed;
+
+    Hasher(uint64_t seed = 0);
+
+    void update(const void* data, size_t length);
+
+    uint64_t digest(); // doesn't change the state, so you can keep updating afterwards
+
+    static uint64_t of(const void* data, size_t length, uint64_t seed = 0); // one-shot
+
+    static std::string hex(uint64_t hash); // 16 lowercase hex digits
+};
@@ -0,0 +1,49 @@
+// IoUring, a bare-bones io_uring ring for batching syscalls
+// We talk to the kernel directly (no liburing) since all we need is "queue a pile of statx/openat/writev/close/fadvise ops, submit them in one go,
+// and collect the results". It's optional: IoUring::enabled is set by --io-uring, and init() fails gracefully (returning false) on kernels or
+// sandboxes where io_uring isn't available, in which case callers just do what they always did.
+// A ring is NOT thread safe. Every thread that batches gets its own.
+#pragma once
+#include <linux/io_uring.h>
+#include <functional>
+#include <vector>
+#include <cstddef>
+
+
+struct IoUring {
+    static bool enabled; // set by main() from --io-uring
+
+    int fd = -1;
+    bool tried = false; // init() has been attempted (whether or not it worked)
+    unsigned entries = 0;
+
+    unsigned* sqHead;
+    unsigned* sqTail;
+    unsigned* sqMask;
+    unsigned* sqArray;
+    struct io_uring_sqe* sqes;
+    unsigned* cqHead;
+    unsigned* cqTail;
+    unsigned* cqMask;
+    struct io_uring_cqe* cqes;
+
+    void* sqRing = NULL;
+    size_t sqRingSize = 0;
+    void* cqRing = NULL;
+    size_t cqRingSize = 0;
+    size_t sqesSize = 0;
+
+    static IoUring& local(); // this thread's ring (not yet init()'d the first time you get it)
+
+    bool init(unsigned size = 256); // set up the ring if enabled and possible. Safe to call repeatedly; only the first call does anything.
+
+    bool usable(); // init() worked
+
+    bool supports(std::vector<int> opcodes); // ask the kernel whether it knows every one of these ops
+
+    void batch(size_t count, std::function<void(struct io_uring_sqe*, size_t)> prep, std::vector<int>& results);
+    // run count operations: prep fills in sqe number i (zeroed beforehand), results[i] gets the cqe result (-errno on failure).
+    // Submitted a ring-full at a time, with one io_uring_enter per ring-full.
+
+    ~IoUring();
+};
@@ -0,0 +1,41 @@
+// Manifest, the record of what the last build wrote
+// Kept in the output directory as .sitix-manifest: one line per output, "<xxh64 hex> <path relative to the output directory>". With it, a build
+// doesn't have to wipe the output first. Every output is still rendered, but if its hash matches what the manifest says is already there, the new copy
+// is thrown away instead of replacing the old one (so mtimes, rsync and CDNs see no change), and anything the manifest lists that this build didn't
+// produce gets pruned at the end.
+// Rendered files are hashed by content. Passthrough files are never read, so their "hash" is of the source's stat signature instead.
+#pragma once
+#include <string>
+#include <vector>
+#include <unordered_map>
+#include <mutex>
+#include <cstdint>
+#include <defs.h>
+
+
+struct Manifest {
+    static constexpr const char* filename = ".sitix-manifest";
+
+    bool enabled = false; // set by FileMan::update once there's a previous manifest to compare against (or a fresh directory to start one in)
+    std::string root; // the output directory
+    std::string base; // where the previous build's outputs (and manifest) are, if that isn't root: the live generation, when building into a staging one
+
+    std::unordered_map<std::string, uint64_t> previous; // what's on disc: loaded from the manifest, then kept up to date as we publish
+    std::unordered_map<std::string, uint64_t> current; // everything this build has produced so far
+    std::vector<std::string> changed; // outputs this build actually wrote (relative paths), in the order they were written
+    std::mutex m_mutex; // the writer thread and the copiers both record
+
+    std::string key(std::string path); // strip root off of a full output path
+
+    bool load(); // read the manifest in base (or root) into previous. Returns false if there isn't one, or it isn't readable.
+
+    bool record(std::string path, uint64_t hash); // note that this build produced path (a full output path) with this hash.
+    // Returns true if that's exactly what's already on disc, in which case the caller shouldn't bother writing it.
+
+    void forget(std::string path); // path (a full output path) was deleted
+
+    std::vector<std::string> prune(); // delete every output that's on disc from an earlier build but wasn't produced by this one (and any directories
+    // that leaves empty). Returns the relative paths of what it deleted. Only call this once everything has been written!
+
+    bool save(); // write current out to the manifest file (atomically)
+};
@@ -4,6 +4,30 @@
 #include <cstddef>
 #include <cstdint>
 #include <string>
+#include <atomic>
+#include <mutex>
+#include <sys/stat.h>
+
+
+struct ArenaSlab { // one big allocation that small files get read() into. It's freed when the last view into any file inside it dies.
+    char* data;
+    size_t used = 0;
+    size_t capacity;
+    std::atomic<int> users; // one per file read into it, plus one while it's the ReadArena's current slab
+
+    void release();
+};
+
+
+struct ReadArena { // bump allocator for small-file reads, so a 200 byte partial costs a read() instead of an mmap/munmap pair and a page fault
+    size_t slabSize = 1024 * 1024;
+    ArenaSlab* current = NULL;
+    std::mutex m_mutex; // several renderers can be loading files into one arena at once
+
+    char* alloc(size_t size, ArenaSlab*& slab); // allocate size bytes, setting slab to the slab they came from (and counting us as a user of it)
+
+    ~ReadArena();
+};
 
 
 class MapView {
@@ -11,21 +35,34 @@ class MapView {
     size_t length; // authoritative length of the WHOLE MEMORY MAP
     size_t start; // starting position of this MapView's slice of the memory map
     size_t end; // ending position of this MapView's slice of the memory map
-    int* rCount; // counts references to the underlying memory map
-    int fd; // file descriptor of the map (useful for statf)
+    std::atomic<int>* rCount; // counts references to the underlying memory map
+    int fd; // file descriptor of the map, if we own one (-1 for maps opened by filename, which are closed right after mapping)
+    ArenaSlab* slab = NULL; // if this isn't NULL, map isn't a memory map at all: it's a read() buffer inside this slab
 
     void init(int, char* mm, size_t size);
+
+    void share(const MapView& m);
+
+    void release();
+
+    void load(int file, size_t size, ReadArena* arena); // fill from a descriptor (which isn't kept), reading into arena if it's non-NULL and mapping otherwise
 public:
     MapView(int, char* mm, size_t size);
 
     MapView(int);
 
-    MapView(std::string filename);
+    MapView(std::string filename, struct stat* sb = NULL, size_t readBelow = 0, ReadArena* arena = NULL); // the file is closed as soon as it's loaded.
+    // Files smaller than readBelow bytes are read() into arena rather than mapped; bigger ones are mapped with sequential readahead hints.
+    // if sb isn't NULL, the stat taken while loading is copied into it (FileMan uses that to tell when the view goes stale)
 
     bool isValid();
 
+    bool isPrivate(); // the bytes are our own copy (read into an arena), rather than a shared map of a file that could change underneath us
+
     MapView(const MapView& m);
 
+    MapView& operator=(const MapView& m);
+
     char operator[](int64_t n);
 
     void operator++(int);
@@ -56,6 +93,4 @@ public:
     void trim(); // tosses whitespace towards the `start`.
 
     char popFront();
-
-    bool needsReload(); // check if the file on disc has changed in a way that would require a remap.
 };
\ No newline at end of file
@@ -1,4 +1,5 @@
 #pragma once
+#include <cstddef>
 #include <fileflags.h>
 #include <sitixwriter.hpp>
 
@@ -15,6 +16,10 @@ struct Node { // superclass
         sitix = session;
     }
 
+    static void* operator new(size_t size); // from the thread's RequestArena while it's rendering a request, the heap otherwise
+
+    static void operator delete(void* ptr);
+
     FileFlags fileflags;
     enum Type {
         OTHER,
@@ -32,4 +37,7 @@ struct Node { // superclass
     virtual void pTree(int tabLevel = 0);
 
     virtual void attachToParent(Object* parent);
+
+    virtual Node* clone() = 0; // deep copy of a freshly parsed node, with no parent. Rendering changes trees (replace, loaded files landing on the
+    // root...), so the parse cache keeps an untouched tree and hands out clones of it.
 };
\ No newline at end of file
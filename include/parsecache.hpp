@@ -0,0 +1,49 @@
+// ParseCache, parsed file trees that outlive a single render
+// Rendering a page parses every template it pulls in, and in watch mode that used to happen from scratch on every save, even though almost none of
+// those files had changed. The cache keeps an untouched parse of each file and hands out clones of it (rendering changes trees, so the cached copy is
+// never rendered itself). The watcher invalidates entries as their files change; as a backstop, an entry whose file doesn't stat the same is dropped.
+// With --serve that backstop is turned off (verify): [@on dynamo] pages come through here on every request, and a stat for the page and each of its
+// templates would be most of the file I/O on the hot path. The watcher (or, without -w, the fact that nothing's supposed to change) has to do.
+// Entries are shared and never changed once they're in, so the lock is only held to find one: the clone happens outside it, and an entry that's
+// invalidated while somebody's cloning it lives until they're done.
+#pragma once
+#include <string>
+#include <unordered_map>
+#include <mutex>
+#include <memory>
+#include <atomic>
+#include <cstdint>
+#include <sys/stat.h>
+#include <defs.h>
+#include <fileflags.h>
+
+
+struct Object;
+
+
+struct ParsedFile {
+    Object* tree = NULL;
+    FileFlags flags; // what the file left the flags as after parsing ([@on minify] and friends)
+    dev_t device; // what the file looked like when it was parsed
+    ino_t inode;
+    off_t size;
+    struct timespec mtime;
+    mutable std::atomic<uint64_t> watched { UINT64_MAX }; // the watcher generation a render of this entry last registered its watches in
+
+    ~ParsedFile();
+};
+
+
+struct ParseCache {
+    std::unordered_map<std::string, std::shared_ptr<const ParsedFile>> files; // by full input path
+    std::mutex m_mutex;
+    bool verify = true; // stat entries on get() to catch changes the watcher missed
+
+    Object* get(std::string path, FileFlags* flags = NULL, uint64_t generation = 0, bool* watched = NULL); // a fresh clone of path's tree (which
+    // the caller owns), or NULL if there isn't a current one. If flags isn't NULL, it's filled with the flags the file was parsed with.
+    // If watched isn't NULL, it says whether this entry was already handed out to render during the watcher's generation (and from now on, it was).
+
+    void put(std::string path, Object* tree, FileFlags flags = FileFlags{}); // remember a clone of a tree that was just parsed from path, and hasn't been rendered
+
+    void invalidate(std::string path); // path changed or went away
+};
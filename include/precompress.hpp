@@ -0,0 +1,54 @@
+// Precompressor, which makes .gz (and .br/.zst, when we're built with those libraries) siblings of outputs for servers like nginx's gzip_static
+// The writer thread keeps the segments of any output that qualifies (right extension, big enough) after writing it, and when the file is closed
+// hands them over to a pool that compresses them straight from memory, while they're still hot, instead of something re-reading the output later.
+// A sibling that isn't meaningfully smaller than the original isn't written at all.
+#pragma once
+#include <string>
+#include <vector>
+#include <unordered_set>
+#include <memory>
+#include <mutex>
+#include <condition_variable>
+#include <functional>
+#include <defs.h>
+#include <threadpool.hpp>
+
+
+struct OutputSegment;
+
+
+struct Precompressor {
+    enum Format {
+        Gzip,
+        Brotli,
+        Zstd
+    };
+
+    std::vector<Format> formats; // which siblings to make. Empty (the default) turns precompression off.
+    std::unordered_set<std::string> extensions { "html", "htm", "css", "js", "mjs", "json", "svg", "xml", "txt", "md" };
+    size_t minSize = 1024; // below this, the compressed file saves less than a packet
+    size_t maxPending = 128 * 1024 * 1024; // how many bytes of outputs can be waiting for compression before the writer has to wait
+    bool fast = false; // -w: every rebuild waits for its siblings, so use quick levels instead of the smallest output (a few percent bigger, many
+    // times faster at brotli and zstd's top settings)
+    size_t pending = 0;
+    std::mutex m_mutex;
+    std::condition_variable room;
+    ThreadPool pool;
+
+    static const char* suffix(Format format); // ".gz" and so on
+
+    static bool parse(std::string name, Format& out); // "gz", "br" or "zst". False if it's not one of those.
+
+    static bool available(Format format); // were we built with the library for this?
+
+    bool wants(std::string path); // is path's extension one we compress?
+
+    bool compress(Format format, std::vector<OutputSegment>& data, std::string& out); // compress data into out, at the level fast asks for.
+    // False if the library fails.
+
+    void submit(size_t size, std::function<void()> task); // run task on the pool, once there's room for size more pending bytes
+
+    void done(size_t size); // a task submitted with size has finished
+
+    void wait(); // block until every submitted task is done
+};
@@ -0,0 +1,36 @@
+// Prefetcher, a background thread that warms the page cache for files we're about to render
+// main() hands it the render queue and tells it how far rendering has gotten; it stays a fixed window of files ahead, calling readahead on each
+// so the renderer finds them already in memory instead of blocking on disc.
+// With --io-uring it takes the whole window at a time and opens, fadvises and closes it in three ring submissions rather than 3 syscalls per file.
+#pragma once
+#include <string>
+#include <vector>
+#include <thread>
+#include <mutex>
+#include <condition_variable>
+#include <defs.h>
+#include <iouring.hpp>
+
+
+struct Prefetcher {
+    size_t window = 32; // how many files ahead of the renderer to stay. 0 turns prefetching off.
+    size_t maxBytes = 2 * 1024 * 1024; // never ask for more than this much of any one file (big passthrough assets don't need it)
+
+    std::vector<std::string> queue;
+    size_t cursor = 0; // the index in queue the renderer is currently on
+    size_t issued = 0; // how far into queue we've issued readaheads
+    bool stopping = false;
+    std::mutex m_mutex;
+    std::condition_variable wake;
+    std::thread worker;
+
+    void start(std::vector<std::string> files); // start prefetching through files (the render queue, in order)
+
+    void advance(size_t to); // the renderer is now working on queue[to]
+
+    void run(); // worker thread body
+
+    void warm(IoUring& ring, std::vector<std::string>& paths); // readahead a batch of files through the ring (--io-uring)
+
+    ~Prefetcher();
+};
@@ -1,34 +1,53 @@
 // Session is a class that contains several FileMans, root configuration data, and any other global properties.
 // Sessions should not be mutated except at the start by the main function. Every Node should contain a pointer to a Session.
+#pragma once
 #include <defs.h>
 #include <string>
 #include <fileman.hpp>
 #include <treewatcher.hpp>
+#include <fileindex.hpp>
+#include <prefetcher.hpp>
+#include <fingerprint.hpp>
+#include <parsecache.hpp>
+#include <threadpool.hpp>
+#include <stats.hpp>
+#include <dynamo.hpp>
 #ifdef INLINE_MODE_LUAJIT
 #include <luajit-2.1/lua.hpp> // TODO: fix this somehow
 #endif
 #include <mutex>
+#include <shared_mutex>
 
 
 struct Session {
-    std::mutex m_mutex;
+    std::shared_mutex m_mutex; // exclusive while the watch loop changes things, shared by on-demand renders (see lockShared)
     std::vector<Object*> config;
     FileMan input;
     FileMan output;
+    FileIndex index; // in-memory picture of the input directory, filled by main() and kept current by the watcher
+    Prefetcher prefetcher; // warms the page cache for the next few files in the render queue
+    Fingerprinter assets; // content-hashed names for passthrough assets, with --fingerprint
+    ParseCache parses; // parsed templates, so they aren't parsed again for every page that uses them (or, in watch mode, every rebuild)
     TreeWatcher watcher;
+    ThreadPool renderers; // watch mode re-renders a change set's pages on this (--render-threads)
+    Stats stats; // where watch mode's time goes, from event to disc (--latency-log)
     bool watchdog;
     bool usesDynamo = false; // do we use Sitix Dynamo (a lil' single-threaded HTTP server designed to replace PHP)?
-    #ifdef INLINE_MODE_LUAJIT
-    lua_State* lua;
-    #endif
+    Dynamo dynamo; // ...which is this, with --serve
 
     Session(std::string, std::string, bool);
 
-    Object* configLookup(std::string name);
+    Object* configLookup(std::string name); // the -c entry called name. Shared by every render, so don't change it: Object::lookup hands out copies.
+
+    #ifdef INLINE_MODE_LUAJIT
+    lua_State* lua(); // this thread's Lua state. Pages are rendered on several threads at once, and a lua_State can only be used by one at a time.
+    #endif
 
     // Session redirects a lot of the functions in input and output:
 
-    FileMan::PathState checkPath(std::string path);
+    FileMan::PathState checkPath(std::string path); // answered from the index when possible, falls back to stat
+
+    std::vector<std::string> listDirectory(std::string path); // sorted names of everything in an input directory, minus dotfiles
 
     std::string transmuted(std::string path);
 
@@ -45,4 +64,9 @@ struct Session {
     void lock(); // forwards to m_mutex
 
     void unlock(); // ditto
+
+    void lockShared(); // for renders that can happen whenever (--on-demand): they can run alongside each other, but not while the watch loop is
+    // in the middle of updating the index or the dependency graph
+
+    void unlockShared();
 };
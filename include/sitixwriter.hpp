@@ -5,28 +5,42 @@
 #include <sitixwriter.hpp>
 #include <mapview.hpp>
 #include <vector>
+#include <writebehind.hpp>
 
 
 struct WriteOutput {
     virtual void write(const char* data, size_t length) = 0;
+
+    virtual void writeSpan(MapView data); // write an untransformed piece of an input. Outputs that can hold on to the view instead of copying it
+    // (FileWriteOutput) override this; everyone else just gets the bytes.
 };
 
 
 struct FileWriteOutput : WriteOutput {
-    const static int BufferSize = 4096; // 4kb buffer
-    int file;
+    const static size_t MinBuffer = 4096; // the buffer starts at 4kb and doubles every time it fills, so small pages cost one small buffer and big pages
+    const static size_t MaxBuffer = 256 * 1024; // get handed off in big chunks
+    const static size_t MinSpan = 512; // spans smaller than this are copied anyways; an iovec for a handful of bytes costs more than the memcpy
+    const static size_t MaxSegments = 256; // flush after this many segments even if the buffer isn't full, so one writev can take them all
+    int file = -1; // only used when writing synchronously (no WriteBehind)
+    OutputFile* target = NULL; // only used when writing through a WriteBehind
+    WriteBehind* writer = NULL;
     bool move = false;
-    char buffer[BufferSize]; // buffer to prevent small writes
-    size_t bufferPos = 0;
+    std::string buffer; // buffer to prevent small writes. When it's full, it's handed off to the writer whole rather than copied.
+    size_t capacity = MinBuffer;
+    std::vector<OutputSegment> segments; // everything written since the last flush that comes before buffer: sealed buffers and mapped spans, in order
 
     FileWriteOutput(FileWriteOutput& f);
 
-    FileWriteOutput(int fd);
+    FileWriteOutput(int fd); // write synchronously to fd
+
+    FileWriteOutput(WriteBehind* wb, std::string path); // write path in the background through wb
 
     ~FileWriteOutput(); // Destructing a FileWriteOutput will flush the buffer and close the file.
 
     void write(const char* data, size_t length); // load some data into the buffer, and flush the buffer if the data overfills
 
+    void writeSpan(MapView data); // queue a reference to mapped input rather than copying it (when writing through a WriteBehind)
+
     void flush();
 };
 
@@ -0,0 +1,58 @@
+// Histogram and Stats, which keep track of how long watch mode takes to get a save onto disc
+// Histograms are HDR-style: values land in buckets that are linear within each power of two, so every recorded value is kept to within 1% no matter
+// whether it's 40 microseconds or 40 seconds, and recording is a couple of atomic adds (renders on the pool record into them at the same time).
+// Stats holds one for each stage of a rebuild. They're printed on SIGUSR1 and when Sitix exits, and with --latency-log each report is also appended
+// to a file as one line of JSON, so p50/p99 preview latency can be compared between releases.
+#pragma once
+#include <string>
+#include <atomic>
+#include <chrono>
+#include <cstdint>
+#include <defs.h>
+
+
+struct Histogram {
+    static const int subBits = 7; // each power of two is split into 2^(subBits - 1) buckets, which is where the 1% comes from
+    static const size_t bucketCount = (64 - subBits + 2) << (subBits - 1);
+
+    const char* name;
+    std::atomic<uint64_t> buckets[bucketCount] = {};
+    std::atomic<uint64_t> count = 0;
+    std::atomic<uint64_t> sum = 0;
+    std::atomic<uint64_t> max = 0;
+
+    Histogram(const char* n);
+
+    void record(uint64_t nanos);
+
+    uint64_t percentile(double p); // the smallest value that at least p percent of the recorded values are at or below (to within a bucket)
+
+    static size_t bucketOf(uint64_t value);
+
+    static uint64_t valueOf(size_t bucket); // the middle of a bucket
+};
+
+
+struct Stats {
+    typedef std::chrono::steady_clock::time_point Time;
+
+    bool enabled = false; // only rebuilds are interesting, so main() turns this on once the initial build is done
+    std::string logName; // --latency-log; empty means don't log
+    Histogram coalesce { "coalesce" }; // first event of a change set until things went quiet and it was handed over
+    Histogram parse { "parse" }; // parsing one file (cache misses only; a cache hit isn't a parse)
+    Histogram render { "render" }; // rendering one output, up to handing it to the writer
+    Histogram write { "write" }; // the last render of a change set until every output is on disc
+    Histogram total { "total" }; // first event of a change set until every output is on disc: what you actually wait for after hitting save
+
+    static Time now();
+
+    static uint64_t since(Time start); // nanoseconds
+
+    void report(); // print every histogram
+
+    void log(const char* reason); // append a line to logName, if there is one
+
+    static void block(); // block SIGUSR1, SIGINT and SIGTERM in this thread and every thread it starts. Call it before any threads exist.
+
+    void listen(); // start a thread that reports on SIGUSR1, and reports and exits on SIGINT or SIGTERM. Needs block() to have been called first.
+};
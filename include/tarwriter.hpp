@@ -0,0 +1,56 @@
+// TarWriter, an output backend that streams everything into one tar archive
+// When the output path ends in .tar (or .tar.gz/.tgz, if we were built with zlib), FileMan hands the WriteBehind one of these instead of creating a
+// directory tree. Every output becomes an entry, written in the order the writer thread finishes them (which is the render order, so the archive is
+// the same every build), with its parent directories added just before the first thing in them. Nothing is ever seeked; the archive is one
+// sequential stream, optionally through gzip.
+#pragma once
+#include <string>
+#include <vector>
+#include <unordered_set>
+#include <ctime>
+#include <defs.h>
+#include <writebehind.hpp>
+#ifdef SITIX_HAVE_ZLIB
+#include <zlib.h>
+#endif
+
+
+struct TarWriter {
+    std::string root; // the archive's path; output paths are prefixed with it (like they would be with a directory), which we strip off
+    int fd = -1;
+    bool gzip = false;
+    time_t mtime; // every entry gets the same mtime: SOURCE_DATE_EPOCH if it's set (for reproducible archives), or the time the build started
+    std::unordered_set<std::string> dirs; // directories that already have an entry
+    std::string buffer; // output waiting to be written (or compressed)
+    size_t bufferSize = 256 * 1024;
+    std::string error; // what went wrong, if anything did. Once it's set, nothing else gets written.
+#ifdef SITIX_HAVE_ZLIB
+    z_stream zs;
+#endif
+
+    static bool isArchive(std::string path); // does this output path ask for an archive?
+
+    bool open(std::string path); // create the archive. Returns false (with error set) if it can't.
+
+    void add(std::string path, std::vector<OutputSegment>& data); // add a file (path is a full output path) made of these segments
+
+    void addFile(std::string path, int in, off_t size); // add a file whose contents are the first size bytes of in (for passthrough copies)
+
+    bool close(); // write the end-of-archive marker, finish compressing, and close. Returns false if anything, at any point, went wrong.
+
+    std::string name(std::string path); // strip root
+
+    void parents(std::string name); // add entries for any directories leading to name that don't have one yet
+
+    void header(std::string name, off_t size, char type, int mode);
+
+    void pad(off_t size); // zero-fill to the end of the 512-byte block
+
+    void emit(const void* data, size_t length); // append to the stream
+
+    void flush(bool finish = false); // push buffer out to fd, through gzip if we're compressing. finish ends the gzip stream.
+
+    void writeOut(const char* data, size_t length); // write to fd, all of it
+
+    ~TarWriter();
+};
@@ -0,0 +1,33 @@
+// ThreadPool, a plain fixed-size pool of worker threads
+// Tasks are run in the order they're submitted (but not necessarily finished in that order). The threads are started lazily on the first submit,
+// so a pool that never gets any work never costs a thread.
+#pragma once
+#include <vector>
+#include <deque>
+#include <thread>
+#include <mutex>
+#include <condition_variable>
+#include <functional>
+
+
+struct ThreadPool {
+    size_t size; // how many threads to run
+
+    std::vector<std::thread> workers;
+    std::deque<std::function<void()>> tasks;
+    size_t active = 0; // tasks currently running
+    bool stopping = false;
+    std::mutex m_mutex;
+    std::condition_variable wake; // there's work (or we're stopping)
+    std::condition_variable idle; // a task finished
+
+    ThreadPool(size_t threads = 0); // 0 means one per core
+
+    void submit(std::function<void()> task);
+
+    void wait(); // block until every task submitted so far has finished
+
+    void run(); // worker thread body
+
+    ~ThreadPool(); // finishes whatever's queued, then joins
+};
@@ -0,0 +1,47 @@
+// Trace, a recording of what watch mode saw, for --record and --replay
+// Every filesystem event the TreeWatcher handles goes in, in order, with when it was read (relative to the start of the recording), its inotify mask,
+// its path relative to the site directory, and for anything that was written, the file's contents as we saw them. Replaying puts the same contents
+// back into a site directory and feeds the same events through the same code, with the recorded timing deciding how they're grouped into ChangeSets,
+// so a storm that happened once on somebody's machine (a big `git checkout`, an editor that saves six times) can be rerun as a benchmark.
+// The format is one text line per event, "<microseconds> <mask in hex> <via directory, 0 or 1> <path length> <content length, or -1 for none>", then
+// the path and the content as raw bytes, then a newline. The first line is just "sitix-trace 1".
+#pragma once
+#include <string>
+#include <cstdio>
+#include <cstdint>
+#include <defs.h>
+#include <stats.hpp>
+
+
+struct TraceEvent {
+    uint64_t offset = 0; // microseconds since the recording started
+    uint32_t mask = 0;
+    bool viaDirectory = false; // did it come from the parent directory's watch (so the directory's listing changed) or the file's own?
+    std::string path; // relative to the site directory
+    bool hasContent = false;
+    std::string content;
+};
+
+
+struct Trace {
+    FILE* file = NULL;
+    Stats::Time start;
+    size_t events = 0; // how many have been written or read so far
+
+    bool record(std::string name); // start a new trace in name. False (and an error printed) if it can't be created.
+
+    bool replay(std::string name); // open name for reading. False if it can't be opened or isn't a trace.
+
+    TraceEvent upcoming; // read ahead, because replay has to see when the next event happens before deciding whether it's part of this ChangeSet
+    bool hasUpcoming = false;
+
+    void write(TraceEvent& event); // offset is filled in from start
+
+    TraceEvent* peek(); // the next event, without using it up. NULL at the end (or if the trace is cut off partway through an event).
+
+    void pop(); // done with whatever peek() returned
+
+    bool read(TraceEvent& event); // the actual parsing, for peek()
+
+    ~Trace();
+};
@@ -2,41 +2,85 @@
 // Sitix builds cache relevant information in TreeWatchers. TreeWatchers are, among other things, a way to manage inotifying; they will intelligently set inotify
 // watchers on newly-indexed files and destroy the watchers on deleted files. They also build dependency trees. When any file is changed in any way, a callback
 // function is invoked to signal the change, in dependencies-first order. 
+// (These days the "callback" is a ChangeSet: invalidate() works out everything downstream of what changed, once each, ordered so that nothing comes
+// before something it depends on. Cycles get broken rather than followed forever.)
+// Events are read off the inotify fd in big batches and collected until things have been quiet for a little while, so a `git checkout` that touches
+// 500 files (or an editor that saves by writing a temp file and renaming it over the original) comes out as one ChangeSet rather than 500 rebuilds.
 #pragma once
 #include <string>
 #include <vector>
+#include <unordered_map>
+#include <unordered_set>
 #include <functional>
+#include <mutex>
+#include <atomic>
+#include <chrono>
 #include <defs.h>
+#include <trace.hpp>
 
 
 struct WatchedPath { // any file or directory being watched.
     std::string path;
     int watcher; // produced by that inotifywait_add_watch function
-    std::vector<WatchedPath*> dependants; // any WatchedPath that depends on this WatchedPath is stored here
+    uint32_t mask; // what we asked inotify for, in case the watch has to be set up again
+    std::unordered_set<WatchedPath*> dependants; // any WatchedPath that depends on this WatchedPath is stored here
+    std::unordered_set<WatchedPath*> dependencies; // the reverse: everything that has us in its dependants, so unwatching us doesn't mean visiting every path
 
     void addDep(WatchedPath* dep);
     
     void rmDep(WatchedPath* dep); // if that file depends on us, remove it
+};
+
 
-    void treeModify(std::function<void(std::string)> onModify); // run modifications up the dep tree
+struct ChangeSet { // everything that happened during one quiet window, with each path appearing at most once
+    std::vector<std::string> modified; // new or changed files and everything that depends on them, each exactly once, dependencies before dependants
+    std::vector<size_t> waves; // modified is split into waves, each starting at one of these indices. Nothing in a wave depends on anything else in
+    // the same wave, so a wave can be rendered in any order (or all at once), as long as the waves before it are done.
+    std::vector<std::string> changed; // just the files that actually changed, without their dependants (these are the ones whose parses are stale)
+    std::vector<std::string> deleted; // files that are gone now. A file that was created and deleted inside the window (like an editor's temp file) isn't anywhere.
+    std::chrono::steady_clock::time_point firstEvent; // when the window's first event was read
+    std::chrono::steady_clock::time_point settled; // when things went quiet (or maxDelay ran out) and the ChangeSet was put together
 };
 
 
 struct TreeWatcher {
-    std::vector<WatchedPath*> files; // every watched path in this tree
+    std::unordered_map<std::string, WatchedPath*> files; // every watched path in this tree, by path
+    std::unordered_map<int, WatchedPath*> watches; // the same, by watch descriptor, for dispatching events
     int inotifier; // the inotify fd
+    int quiet = 50; // milliseconds without any new events before a ChangeSet is handed over (--debounce)
+    int maxDelay = 1000; // ...but never hold onto changes for longer than this, even if something keeps writing
+    std::mutex m_mutex; // pages rendering on the pool watch paths and add dependencies as they go, and on-demand requests watch pages from the
+    // server's threads without holding the session at all, so everything that touches files, watches or the graph takes this
+    Trace* recording = NULL; // --record: every event handled is written here too, with the contents of whatever was written
+    Trace* replaying = NULL; // --replay: events come from here instead of inotify (which isn't used at all), grouped by their recorded times
+    bool finished = false; // the replay has run out of events
+    std::atomic<uint64_t> generation = 0; // bumped every time a ChangeSet is handed over. A page rendered twice in one generation looks up the same
+    // files both times, so the second render can skip registering them (see Object::watched)
 
     TreeWatcher();
 
     ~TreeWatcher();
 
+    WatchedPath* find(std::string path); // NULL if the path isn't watched
+
+    WatchedPath* watch(std::string path, uint32_t mask); // find the path, or start watching it
+
     WatchedPath* filewatch(std::string file);
 
     WatchedPath* dirwatch(std::string path);
 
+    void depend(WatchedPath* dependency, WatchedPath* dependant); // dependency -> addDep(dependant), but safe to call from several renders at once
+
+    void rewatch(WatchedPath* path); // set the watch up again, for when the path is now a different inode (something was renamed over it)
+
+    void invalidate(std::vector<WatchedPath*>& roots, ChangeSet& changes); // fill in changes.modified and changes.waves with the files in roots and
+    // everything that transitively depends on them. Directories in roots aren't rendered themselves, but whatever depends on them is.
+
     void unwatch(std::string path); // un-watch a file or directory
 
-    void waitForModifications(Session* sitix, std::function<void(std::string)> onModify, std::function<void(std::string)> onDelete);
-    // onModify is called upon adding as well.
-    // waitForModifications breaks every time events are received, giving the outside program the option to either continue or end.
+    ChangeSet waitForModifications(Session* sitix); // block until something changes, then collect events until things settle down.
+    // The file index and the set of watched paths are kept current as events come in; the returned ChangeSet is what needs to be re-rendered or removed.
+    // If the kernel's event queue overflowed, the index is resynced against the disc to find whatever we weren't told about.
+    // When replaying, the next window's worth of events is taken from the trace (and applied to the site directory) straight away instead. At the end
+    // of the trace, finished is set and the ChangeSet is empty.
 };
\ No newline at end of file
@@ -13,4 +13,6 @@ struct Copier : Node {
     Copier(Session* session);
 
     void render(SitixWriter* out, Object* scope, bool dereference);
+
+    Node* clone();
 };
\ No newline at end of file
@@ -9,5 +9,7 @@ struct DebuggerStatement : Node {
 
     void render(SitixWriter* out, Object* scope, bool dereference);
 
+    Node* clone();
+
     void pTree(int tabLevel);
 };
\ No newline at end of file
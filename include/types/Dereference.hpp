@@ -10,4 +10,6 @@ struct Dereference : Node { // dereference and render an Object (the [^] operato
     Dereference(Session* session);
 
     void render(SitixWriter* out, Object* scope, bool dereference);
+
+    Node* clone();
 };
\ No newline at end of file
@@ -18,5 +18,7 @@ struct ForLoop : Node {
 
     void render(SitixWriter* out, Object* scope, bool dereference);
 
+    Node* clone();
+
     virtual void pTree(int tabLevel = 0);
 };
\ No newline at end of file
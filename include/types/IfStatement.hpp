@@ -19,4 +19,6 @@ struct IfStatement : Node {
     ~IfStatement();
 
     void render(SitixWriter* out, Object* scope, bool dereference);
+
+    Node* clone();
 };
\ No newline at end of file
@@ -20,6 +20,9 @@ struct Object : Node { // Sitix objects contain a list of *nodes*, which can be
 
     bool virile = true; // does it call replace()?
 
+    bool watched = false; // on a page's root: this page was already rendered since the last change, so the watches and dependencies its lookups
+    // would register are all in place and needn't go through the watcher's lock again (--serve renders the same page over and over)
+
     Object(Session*);
 
     std::string name; // a union would save some bytes of space but would cause annoying crap with the std::string name.
@@ -35,6 +38,8 @@ struct Object : Node { // Sitix objects contain a list of *nodes*, which can be
 
     void render(SitixWriter* out, Object* scope, bool dereference);
 
+    Node* clone();
+
     void addChild(Node* child);
 
     void dropObject(Object* object);
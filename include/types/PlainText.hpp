@@ -13,5 +13,7 @@ struct PlainText : Node {
 
     void render(SitixWriter* stream, Object* scope, bool dereference);
 
+    Node* clone();
+
     void pTree(int tabLevel = 0);
 };
\ No newline at end of file
@@ -14,4 +14,6 @@ struct RedirectorStatement : Node {
     void attachToParent(Object* p);
 
     void render(SitixWriter*, Object* scope, bool dereference);
+
+    Node* clone();
 };
\ No newline at end of file
@@ -13,5 +13,7 @@ struct TextBlob : Node { // designed for smaller, heap-allocated text bits that
 
     void render(SitixWriter* out, Object* scope, bool dereference);
 
+    Node* clone();
+
     void pTree(int tabLevel = 0);
 };
\ No newline at end of file
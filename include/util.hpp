@@ -1,5 +1,6 @@
 #pragma once
 #include <string>
+#include <vector>
 #include <cstring>
 #include <cstdint>
 #include <sys/stat.h>
@@ -14,6 +15,8 @@ void mkdirR(std::string filename);
 
 std::string escapeString(std::string thing, char toEscape);
 
+std::string escapeHTML(std::string thing); // &, <, >, " and ' as entities, for putting untrusted text in a page
+
 char* truncatn(const char* thing, size_t n, char stop);
 
 bool isNumber(const char* data);
@@ -37,6 +40,8 @@ void rmrf(const char* path);
 
 int coterminal(int num, int about);
 
+std::vector<std::string> split(std::string thing, char delimiter); // split on every delimiter, dropping empty pieces
+
 std::string trim2dir(std::string file); // strip off a filename from a path
 // if the path ends in /, it will not be changed
 // the output will always be formatted for quick appending: if it is not fully stripped to an empty string, the last character will be a /
\ No newline at end of file
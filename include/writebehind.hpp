@@ -0,0 +1,171 @@
+// WriteBehind, the asynchronous output stage
+// Renderers don't touch the output directory themselves. FileWriteOutputs hand their finished buffers to a WriteBehind, whose thread does the directory
+// creation, opens, writes and closes in the background, in the order they were queued. A renderer only ever blocks when more than maxInflight bytes
+// are queued up and not yet written. Errors are collected on the writer thread and handed back to whoever calls drain().
+// With --io-uring, each batch's opens, writes and closes go to the kernel as three ring submissions instead of a few syscalls per file.
+// Files are created relative to cached directory fds and written anonymously (O_TMPFILE, or a dotfile if the filesystem can't do that), then linked
+// into place once they're complete, so nothing reading the output ever sees half a page.
+// Passthrough files (anything that isn't Sitix) skip all of that and are copied kernel-side on a separate pool, alongside rendering.
+#pragma once
+#include <string>
+#include <vector>
+#include <deque>
+#include <unordered_set>
+#include <unordered_map>
+#include <atomic>
+#include <thread>
+#include <mutex>
+#include <condition_variable>
+#include <optional>
+#include <defs.h>
+#include <mapview.hpp>
+#include <threadpool.hpp>
+#include <iouring.hpp>
+#include <hash.hpp>
+#include <manifest.hpp>
+#include <precompress.hpp>
+
+
+struct TarWriter;
+
+
+struct OutputSegment { // a piece of an output file: either bytes we generated, or an untouched span of an input that's still mapped
+    std::string bytes;
+    std::optional<MapView> view; // if this is set, bytes is ignored. Holding the view keeps the input mapped until the segment is written.
+
+    const char* data();
+
+    size_t size();
+};
+
+
+struct OutputFile { // a file being written by the WriteBehind thread. After open() returns it, only the writer thread looks inside.
+    std::string path;
+    int dir = -1; // the directory it's going in (see WriteBehind::directory), and its name in there
+    std::string name;
+    bool ownsDir = false; // dir isn't in the cache, so it's ours to close
+    std::string temp; // the name we're writing it under until it's done, if O_TMPFILE isn't available. Empty while the file is anonymous.
+    int fd = -1;
+    Hasher hash; // of everything written so far, for the manifest
+    bool compress = false; // make precompressed siblings of this file, if it turns out to be big enough (see Precompressor)
+    std::vector<OutputSegment> held; // with an archive or compress, everything written so far (it all goes in at once, when the file is closed)
+    bool recorded = false; // already in the manifest (copies record a fingerprint of their source up front, rather than a hash of what's written)
+    off_t offset = 0; // where the next write goes. Writes are positional so they can be batched through io_uring without racing the file offset.
+    bool failed = false; // once anything goes wrong, the rest of the file's jobs are skipped
+};
+
+
+struct OutputJob {
+    enum Op {
+        Open,   // create parent directories and open the file (anonymously)
+        Write,  // gather-write segments to the file
+        Close,  // publish and close the file (and free the OutputFile)
+        Remove, // delete path from the output
+        Copy    // with an archive: add the input file data as file's contents (without an archive, copies don't go through the queue at all)
+    } op;
+    OutputFile* file = NULL;
+    std::vector<OutputSegment> segments; // for Write
+    size_t owned = 0; // for Write: how many bytes of segments are generated (not mapped) memory, which is what counts against maxInflight
+    std::string data; // for Remove: the path. For Copy: the input file.
+};
+
+
+struct WriteBehind {
+    enum LinkMode {
+        Copy,     // copy_file_range, falling back to sendfile, then read/write
+        Reflink,  // FICLONE (shares extents on btrfs/xfs), falling back to copying
+        Hardlink  // link the input straight into the output, falling back to copying (output edits will show up in the input!)
+    } linkMode = Copy;
+
+    size_t maxInflight = 64 * 1024 * 1024; // how many generated bytes can be queued before renderers have to wait for the disc to catch up
+    // (mapped spans don't count, they're already in memory whether we queue them or not)
+    bool mappedSpans = true; // queue spans of mmapped inputs by reference. Off when inputs can change under us (-w and --serve): an editor that
+    // rewrites a file in place would leave the writer (or the compressor) reading torn bytes, or SIGBUS if it got shorter. Arena reads are always fine.
+
+    std::deque<OutputJob> jobs;
+    size_t inflight = 0; // bytes in jobs that haven't been written yet
+    bool busy = false; // the writer thread is in the middle of a batch
+    bool stopping = false;
+    std::mutex m_mutex;
+    std::condition_variable wake; // signals the writer that there's work (or that it should stop)
+    std::condition_variable progress; // signals waiting renderers (and drain()) that the writer got something done
+    std::thread worker;
+
+    ThreadPool copiers; // passthrough copies run here, so a gigabyte of video doesn't hold up page writes
+
+    std::unordered_map<std::string, int> dirFds; // directories we've already created or found, kept open so files can be made relative to them
+    size_t maxDirFds = 512; // stop caching past this many, so a site with thousands of directories doesn't run us out of fds
+    std::mutex dirMutex; // the writer thread and the copiers both make directories
+    std::atomic<bool> tmpfiles = true; // write files as O_TMPFILEs and link them in when they're done. Cleared if the output filesystem can't.
+    Precompressor precompress; // .gz/.br/.zst siblings. Off unless it's given some formats.
+
+    TarWriter* archive = NULL; // if this is set, everything goes into it instead of into files (see FileMan's constructor). Owned by us.
+
+    Manifest manifest; // when it's enabled, finished files whose hash matches the last build's are thrown away instead of published
+
+    size_t maxBatchFiles = 256; // with --io-uring, how many files a single batch can have open at once
+    std::vector<std::string> errors; // guarded by m_mutex
+
+    OutputFile* open(std::string path); // queue up opening (and creating the parents of) path
+
+    void write(OutputFile* file, std::vector<OutputSegment>&& segments); // queue up writing segments, in order, with writev. Nothing is copied.
+
+    void close(OutputFile* file); // queue up closing the file. Don't touch file after this.
+
+    void remove(std::string path); // queue up deleting path
+
+    void copy(std::string from, std::string to); // queue up copying the input file from to the output path to (see linkMode)
+
+    void copyFile(std::string from, std::string to); // copier thread body for copy()
+
+    std::vector<std::string> drain(); // block until everything queued so far (copies too) is on disc, then return (and forget) the errors
+    // reported since the last drain
+
+    void error(std::string message); // report an error from any thread
+
+    void submit(OutputJob job);
+
+    void run(); // writer thread body
+
+    void perform(OutputJob& job);
+
+    void keep(OutputFile* file, std::vector<OutputSegment>& segments); // after writing segments, hang on to them if file is going to be compressed
+
+    void siblings(OutputFile* file); // file has been published (or found unchanged): make its precompressed siblings from what keep() held,
+    // on the precompressor's pool. Siblings of unchanged files are reused from the last build without compressing anything.
+
+    void siblings(std::string path, uint64_t source, size_t size, std::shared_ptr<std::vector<OutputSegment>> data, std::string from);
+    // the guts of that: path is the output, source its manifest hash, size its size, and data its contents. For passthrough copies, data is empty
+    // and the input file from gets mapped (on the pool, and only if something actually needs compressing).
+
+    void performArchive(OutputJob& job); // perform(), when there's an archive
+
+    size_t performBatch(IoUring& ring, std::deque<OutputJob>& batch, size_t start); // --io-uring version of perform(), for as many jobs from start
+    // as can safely go at once. Returns where it stopped.
+
+    int directory(std::string path, bool& owned); // an fd for the output directory path, creating it (and its parents) if we haven't seen it before.
+    // -1 (after reporting an error) if it can't be made. If owned comes back true, the cache was full and the caller has to close the fd.
+
+    void forget(std::string path); // drop cached directory fds for path and anything under it, after it's been removed
+
+    static std::string tempName(std::string name); // what to call a file while it's being written, when it can't be anonymous
+
+    bool locate(OutputFile* file); // fill in file's dir and name. On failure, marks the file failed and returns false.
+
+    bool openTemp(OutputFile* file); // open the file's not-yet-visible stand-in: an O_TMPFILE in its directory, or tempName() if that isn't supported.
+    // Returns false with errno set on failure.
+
+    static off_t transfer(int in, int out, off_t left); // copy left bytes from in's file offset to out's, by whatever means works.
+    // Returns how many bytes it couldn't copy (0 on success).
+
+    void publish(OutputFile* file); // atomically put a completely written file in place, replacing whatever was there
+
+    bool unchanged(OutputFile* file); // record a finished file in the manifest. True if what's on disc is already identical, so it needn't be published.
+
+    bool reuse(OutputFile* file); // the manifest says file is identical to last build's: make sure last build's copy is where file would go.
+    // Returns false if it can't (it's been deleted), in which case the file has to be written after all.
+
+    void finish(OutputFile* file); // publish (unless it failed or is unchanged) and close the file, and its directory if we own that
+
+    ~WriteBehind();
+};
@@ -0,0 +1,67 @@
+#!/bin/sh
+# Cold page cache benchmark for Sitix input loading.
+# Generates a synthetic site (lots of tiny partials, some mid-size pages, a few big sequentially-parsed files), then builds it with a few different
+# read strategies, dropping the page cache before every run when we're allowed to (root on Linux). If we can't drop caches, the numbers are warm-cache
+# numbers and the script says so.
+# Usage: sh coldcache.sh path/to/sitix [pages] [runs]
+
+SITIX=${1:-./build/sitix}
+PAGES=${2:-20000}
+RUNS=${3:-3}
+WORK=$(mktemp -d)
+trap 'rm -rf "$WORK"' EXIT
+
+mkdir -p "$WORK/site/partials" "$WORK/site/pages" "$WORK/site/big"
+i=0
+while [ $i -lt 200 ]; do
+    printf '[?]\n[=title Partial %d]\n<div class="partial-%d">small partial content</div>\n' $i $i > "$WORK/site/partials/p$i.stx"
+    i=$((i + 1))
+done
+i=0
+while [ $i -lt "$PAGES" ]; do
+    {
+        printf '[!]\n<html><body>\n'
+        printf '[^partials/p%d\\.stx]\n' $((i % 200))
+        head -c 6000 /dev/zero | tr '\0' 'x'
+        printf '\n</body></html>\n'
+    } > "$WORK/site/pages/page$i.html"
+    i=$((i + 1))
+done
+i=0
+while [ $i -lt 8 ]; do
+    { printf '[!]\n'; head -c 8000000 /dev/zero | tr '\0' 'y'; } > "$WORK/site/big/big$i.html"
+    i=$((i + 1))
+done
+
+dropcaches() {
+    sync
+    if [ -w /proc/sys/vm/drop_caches ]; then
+        echo 3 > /proc/sys/vm/drop_caches
+        return 0
+    fi
+    return 1
+}
+
+run() { # run <label> <extra sitix args>
+    label=$1
+    shift
+    total=0
+    cold=yes
+    r=0
+    while [ $r -lt "$RUNS" ]; do
+        dropcaches || cold=no
+        start=$(date +%s%N)
+        "$SITIX" "$WORK/site" -o "$WORK/out" -y "$@" > /dev/null 2>&1
+        end=$(date +%s%N)
+        total=$((total + (end - start) / 1000000))
+        r=$((r + 1))
+    done
+    printf '%-40s %8d ms/run (cold cache: %s)\n' "$label" $((total / RUNS)) "$cold"
+}
+
+echo "$PAGES pages, 200 partials, 8 x 8MB files, $RUNS runs each"
+run "mmap everything, no prefetch" --read-threshold 0 --prefetch 0
+run "mmap everything, prefetch 32" --read-threshold 0 --prefetch 32
+run "read below 16k, no prefetch" --read-threshold 16384 --prefetch 0
+run "read below 16k, prefetch 32 (default)"
+run "read below 64k, prefetch 128" --read-threshold 65536 --prefetch 128
@@ -0,0 +1,59 @@
+#!/bin/sh
+# io_uring vs plain syscalls benchmark for Sitix.
+# Generates a wide, shallow tree of tiny files (FILES of them, 100 per directory, a quarter of them Sitix pages and the rest passthrough), which is
+# the shape where per-file syscall overhead (the statx in the index walk, and the open/write/close for every output) dominates the build. Then builds
+# it with and without --io-uring. If strace is installed, it also prints the syscall counts for one build of each, which is where the difference
+# really shows; wall time mostly depends on how expensive syscalls are on your machine (mitigations, virtualization...).
+# Usage: sh uring.sh path/to/sitix [files] [runs]
+
+SITIX=${1:-./build/sitix}
+FILES=${2:-100000}
+RUNS=${3:-3}
+WORK=$(mktemp -d)
+trap 'rm -rf "$WORK"' EXIT
+
+i=0
+while [ $i -lt "$FILES" ]; do
+    d="$WORK/site/d$((i / 100))"
+    if [ $((i % 100)) -eq 0 ]; then
+        mkdir -p "$d"
+    fi
+    if [ $((i % 4)) -eq 0 ]; then
+        printf '[!]\n[=title Page %d]\n<html><body><h1>[^title]</h1></body></html>\n' $i > "$d/page$i.html"
+    else
+        printf 'asset %d\n' $i > "$d/asset$i.txt"
+    fi
+    i=$((i + 1))
+done
+
+run() { # run <label> <extra sitix args>
+    label=$1
+    shift
+    total=0
+    r=0
+    while [ $r -lt "$RUNS" ]; do
+        start=$(date +%s%N)
+        "$SITIX" "$WORK/site" -o "$WORK/out" -y "$@" > /dev/null 2>&1
+        end=$(date +%s%N)
+        total=$((total + (end - start) / 1000000))
+        r=$((r + 1))
+    done
+    printf '%-30s %8d ms/run\n' "$label" $((total / RUNS))
+}
+
+count() { # count <label> <extra sitix args>
+    label=$1
+    shift
+    strace -c -f -o "$WORK/strace" "$SITIX" "$WORK/site" -o "$WORK/out" -y "$@" > /dev/null 2>&1
+    printf '%-30s %8s syscalls\n' "$label" "$(awk '$NF == "total" { print $(NF - 2) }' "$WORK/strace")"
+}
+
+echo "$FILES files, $RUNS runs each"
+run "plain syscalls (default)"
+run "--io-uring" --io-uring
+if command -v strace > /dev/null 2>&1; then
+    count "plain syscalls (default)"
+    count "--io-uring" --io-uring
+else
+    echo "strace isn't installed, so no syscall counts."
+fi
@@ -0,0 +1,88 @@
+// definitions for RequestArena
+
+#include <arena.hpp>
+#include <cstdlib>
+#include <new>
+
+
+static thread_local RequestArena arena;
+
+
+RequestArena* RequestArena::current() {
+    return arena.depth > 0 && !arena.suspended ? &arena : NULL;
+}
+
+void RequestArena::enter() {
+    arena.depth ++;
+}
+
+void RequestArena::leave() {
+    arena.depth --;
+    if (arena.depth == 0) {
+        arena.rewind();
+    }
+}
+
+void RequestArena::suspend() {
+    arena.suspended = true;
+}
+
+void RequestArena::resume() {
+    arena.suspended = false;
+}
+
+bool RequestArena::holds(void* ptr) {
+    return arena.depth > 0 && arena.owns(ptr);
+}
+
+void* RequestArena::alloc(size_t size) {
+    size = (size + alignof(std::max_align_t) - 1) & ~(alignof(std::max_align_t) - 1);
+    while (block < blocks.size() && sizes[block] - used < size) { // (the rest of a block that's too full is just wasted until the rewind)
+        block ++;
+        used = 0;
+    }
+    if (block == blocks.size()) {
+        size_t capacity = size > blockSize ? size : blockSize;
+        char* fresh = (char*)malloc(capacity);
+        if (fresh == NULL) {
+            throw std::bad_alloc();
+        }
+        blocks.push_back(fresh);
+        sizes.push_back(capacity);
+        used = 0;
+    }
+    void* ret = blocks[block] + used;
+    used += size;
+    return ret;
+}
+
+bool RequestArena::owns(void* ptr) {
+    for (size_t i = 0; i < blocks.size(); i ++) { // there are only ever a handful of blocks
+        if ((char*)ptr >= blocks[i] && (char*)ptr < blocks[i] + sizes[i]) {
+            return true;
+        }
+    }
+    return false;
+}
+
+void RequestArena::rewind() {
+    size_t kept = 0;
+    size_t i = 0;
+    while (i < blocks.size() && kept + sizes[i] <= keepBytes) {
+        kept += sizes[i];
+        i ++;
+    }
+    for (size_t j = i; j < blocks.size(); j ++) {
+        free(blocks[j]);
+    }
+    blocks.resize(i);
+    sizes.resize(i);
+    block = 0;
+    used = 0;
+}
+
+RequestArena::~RequestArena() {
+    for (char* b : blocks) {
+        free(b);
+    }
+}
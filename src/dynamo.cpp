@@ -0,0 +1,1156 @@
+// definitions for Dynamo
+
+#include <dynamo.hpp>
+#include <sys/socket.h>
+#include <sys/epoll.h>
+#include <sys/eventfd.h>
+#include <sys/sendfile.h>
+#include <sys/stat.h>
+#include <sys/uio.h>
+#include <netinet/in.h>
+#include <netinet/tcp.h>
+#include <arpa/inet.h>
+#include <fcntl.h>
+#include <unistd.h>
+#include <pthread.h>
+#include <sched.h>
+#include <csignal>
+#include <cstring>
+#include <cerrno>
+#include <algorithm>
+#include <cstdio>
+#include <hash.hpp>
+#include <util.hpp>
+
+
+static const char* reason(int code) {
+    switch (code) {
+        case 200: return "OK";
+        case 301: return "Moved Permanently";
+        case 304: return "Not Modified";
+        case 400: return "Bad Request";
+        case 403: return "Forbidden";
+        case 404: return "Not Found";
+        case 405: return "Method Not Allowed";
+        case 431: return "Request Header Fields Too Large";
+        case 500: return "Internal Server Error";
+        case 501: return "Not Implemented";
+        case 505: return "HTTP Version Not Supported";
+    }
+    return "Unknown";
+}
+
+static const char* contentType(std::string& path) {
+    static const std::unordered_map<std::string, const char*> types {
+        { "html", "text/html; charset=utf-8" }, { "htm", "text/html; charset=utf-8" }, { "css", "text/css; charset=utf-8" },
+        { "js", "text/javascript; charset=utf-8" }, { "mjs", "text/javascript; charset=utf-8" }, { "json", "application/json" },
+        { "xml", "application/xml" }, { "txt", "text/plain; charset=utf-8" }, { "md", "text/markdown; charset=utf-8" },
+        { "svg", "image/svg+xml" }, { "png", "image/png" }, { "jpg", "image/jpeg" }, { "jpeg", "image/jpeg" }, { "gif", "image/gif" },
+        { "webp", "image/webp" }, { "avif", "image/avif" }, { "ico", "image/x-icon" }, { "woff", "font/woff" }, { "woff2", "font/woff2" },
+        { "ttf", "font/ttf" }, { "otf", "font/otf" }, { "pdf", "application/pdf" }, { "wasm", "application/wasm" }, { "mp4", "video/mp4" },
+        { "webm", "video/webm" }, { "mp3", "audio/mpeg" }, { "ogg", "audio/ogg" }, { "map", "application/json" }
+    };
+    size_t dot = path.rfind('.');
+    if (dot == std::string::npos || path.find('/', dot) != std::string::npos) {
+        return "application/octet-stream";
+    }
+    auto type = types.find(path.substr(dot + 1));
+    return type == types.end() ? "application/octet-stream" : type -> second;
+}
+
+static std::string httpDate(time_t when) {
+    struct tm parts;
+    gmtime_r(&when, &parts);
+    char buffer[64];
+    strftime(buffer, sizeof(buffer), "%a, %d %b %Y %H:%M:%S GMT", &parts);
+    return buffer;
+}
+
+static std::string etagFor(struct stat& sb) { // like nginx's: cheap, and it changes whenever the file does (every output is replaced, never edited)
+    char buffer[64];
+    snprintf(buffer, sizeof(buffer), "\"%lx-%lx-%lx\"", (unsigned long)sb.st_mtim.tv_sec, (unsigned long)sb.st_mtim.tv_nsec, (unsigned long)sb.st_size);
+    return buffer;
+}
+
+static bool notModified(std::unordered_map<std::string, std::string>& headers, std::string& etag, time_t mtime) {
+    auto match = headers.find("if-none-match");
+    if (match != headers.end()) { // when there's an If-None-Match, If-Modified-Since is ignored
+        std::string& list = match -> second;
+        size_t at = 0;
+        while (at < list.size()) {
+            size_t end = list.find(',', at);
+            if (end == std::string::npos) {
+                end = list.size();
+            }
+            std::string tag = list.substr(at, end - at);
+            size_t first = tag.find_first_not_of(" \t");
+            size_t last = tag.find_last_not_of(" \t");
+            tag = first == std::string::npos ? "" : tag.substr(first, last - first + 1);
+            if (tag.rfind("W/", 0) == 0) { // weak comparison is what If-None-Match uses
+                tag = tag.substr(2);
+            }
+            if (tag == "*" || tag == etag) {
+                return true;
+            }
+            at = end + 1;
+        }
+        return false;
+    }
+    auto since = headers.find("if-modified-since");
+    if (since != headers.end()) {
+        struct tm parts;
+        memset(&parts, 0, sizeof(parts));
+        const char* end = strptime(since -> second.c_str(), "%a, %d %b %Y %H:%M:%S GMT", &parts);
+        if (end != NULL) {
+            return mtime <= timegm(&parts);
+        }
+    }
+    return false;
+}
+
+static int hexValue(char c) {
+    if (c >= '0' && c <= '9') {
+        return c - '0';
+    }
+    if (c >= 'a' && c <= 'f') {
+        return c - 'a' + 10;
+    }
+    if (c >= 'A' && c <= 'F') {
+        return c - 'A' + 10;
+    }
+    return -1;
+}
+
+
+DynamoCache::DynamoCache() {
+    for (size_t i = 0; i < Shards; i ++) {
+        shards[i] = std::make_shared<const DynamoShard>();
+    }
+}
+
+size_t DynamoCache::shardOf(const std::string& path) {
+    return std::hash<std::string>{}(path) % Shards;
+}
+
+const DynamoShard& DynamoCache::shard(const std::string& path) const {
+    return *shards[shardOf(path)];
+}
+
+
+bool Dynamo::start() {
+    signal(SIGPIPE, SIG_IGN); // a client hanging up mid-response is an EPIPE, not a reason to die
+    cpu_set_t allowed; // the cores we're allowed on (which, in a container, mightn't be all of them)
+    std::vector<int> cores;
+    if (sched_getaffinity(0, sizeof(allowed), &allowed) == 0) {
+        for (int core = 0; core < CPU_SETSIZE; core ++) {
+            if (CPU_ISSET(core, &allowed)) {
+                cores.push_back(core);
+            }
+        }
+    }
+    size_t count = workerCount > 0 ? workerCount : cores.size() > 0 ? cores.size() : 1;
+    for (size_t i = 0; i < count; i ++) {
+        DynamoWorker* loop = new DynamoWorker;
+        loop -> server = this;
+        if (count > 1 && cores.size() > 0) { // (one loop can go wherever the scheduler likes)
+            loop -> core = cores[i % cores.size()];
+        }
+        workers.push_back(loop);
+        if (!loop -> start()) {
+            return false;
+        }
+    }
+    std::vector<DynamoChange> none;
+    publish(none); // (for anything mark()ed during the build)
+    if (count > 1) {
+        printf(DYNAMO "Serving %s on http://%s:%d/ with %zu workers\n", root.c_str(), address.c_str(), port, count);
+    }
+    else {
+        printf(DYNAMO "Serving %s on http://%s:%d/\n", root.c_str(), address.c_str(), port);
+    }
+    return true;
+}
+
+void Dynamo::run() {
+    for (DynamoWorker* loop : workers) {
+        loop -> thread = std::thread(&DynamoWorker::run, loop);
+    }
+    for (DynamoWorker* loop : workers) {
+        loop -> thread.join();
+    }
+}
+
+void Dynamo::invalidate(std::string path) {
+    {
+        std::lock_guard<std::mutex> lock(m_mutex);
+        invalidatedAt[path] = ++ epoch;
+        pending.push_back(DynamoChange { DynamoChange::Drop, path });
+    }
+    if (workers.size() > 0) { // the first worker publishes it. (Before start(), start() does.)
+        workers[0] -> poke();
+    }
+}
+
+void Dynamo::mark(std::string path, bool isDynamic) {
+    {
+        std::lock_guard<std::mutex> lock(m_mutex);
+        pending.push_back(DynamoChange { isDynamic ? DynamoChange::Dynamic : DynamoChange::Static, path });
+    }
+    if (workers.size() > 0) {
+        workers[0] -> poke();
+    }
+}
+
+void Dynamo::publish(std::vector<DynamoChange>& changes) {
+    std::unique_lock<std::mutex> lock(m_mutex);
+    for (DynamoChange& change : changes) {
+        pending.push_back(std::move(change));
+    }
+    changes.clear();
+    if (publishing) { // they'll get ours too, once they're done with what they have
+        return;
+    }
+    publishing = true;
+    while (pending.size() > 0) {
+        std::vector<DynamoChange> batch;
+        for (DynamoChange& change : pending) {
+            if (change.kind == DynamoChange::Store) {
+                auto invalidated = invalidatedAt.find(change.path);
+                if (invalidated != invalidatedAt.end() && invalidated -> second > change.since) { // it was read or rendered before its latest change
+                    // was seen, so it's probably the old version
+                    continue;
+                }
+            }
+            batch.push_back(std::move(change));
+        }
+        pending.clear();
+        std::shared_ptr<const DynamoCache> base = published; // (nobody else swaps it while we're publishing)
+        lock.unlock();
+        std::shared_ptr<DynamoCache> next = std::make_shared<DynamoCache>(*base); // (just the shard pointers)
+        std::array<std::shared_ptr<DynamoShard>, DynamoCache::Shards> copied; // the shards this generation has its own copies of
+        auto shard = [&](size_t i) -> DynamoShard& {
+            if (copied[i] == NULL) {
+                copied[i] = std::make_shared<DynamoShard>(*next -> shards[i]);
+                next -> shards[i] = copied[i];
+            }
+            return *copied[i];
+        };
+        for (DynamoChange& change : batch) {
+            DynamoShard& into = shard(DynamoCache::shardOf(change.path));
+            auto entry = into.files.find(change.path);
+            switch (change.kind) {
+                case DynamoChange::Store:
+                    if (entry != into.files.end()) {
+                        next -> bytes -= entry -> second -> body -> size();
+                    }
+                    into.files[change.path] = change.file;
+                    next -> bytes += change.file -> body -> size();
+                    break;
+                case DynamoChange::Drop:
+                    if (entry != into.files.end()) {
+                        next -> bytes -= entry -> second -> body -> size();
+                        into.files.erase(entry);
+                    }
+                    break;
+                case DynamoChange::Dynamic:
+                    into.dynamic.insert(change.path);
+                    break;
+                case DynamoChange::Static:
+                    into.dynamic.erase(change.path);
+                    break;
+            }
+        }
+        if (next -> bytes > cacheBytes) { // evict the least recently served, down to cacheBytes
+            std::vector<std::pair<time_t, std::string>> ages;
+            for (size_t i = 0; i < DynamoCache::Shards; i ++) {
+                for (auto& [path, file] : next -> shards[i] -> files) {
+                    ages.push_back({ file -> used, path });
+                }
+            }
+            std::sort(ages.begin(), ages.end());
+            for (size_t i = 0; i < ages.size() && next -> bytes > cacheBytes; i ++) {
+                DynamoShard& from = shard(DynamoCache::shardOf(ages[i].second));
+                auto victim = from.files.find(ages[i].second);
+                next -> bytes -= victim -> second -> body -> size();
+                from.files.erase(victim);
+            }
+        }
+        lock.lock();
+        published = next;
+        generation ++;
+    }
+    publishing = false;
+}
+
+
+bool DynamoWorker::start() {
+    listener = socket(AF_INET, SOCK_STREAM | SOCK_NONBLOCK | SOCK_CLOEXEC, 0);
+    if (listener == -1) {
+        printf(ERROR "Couldn't create the server socket.\n");
+        perror("\tsocket");
+        return false;
+    }
+    int yes = 1;
+    setsockopt(listener, SOL_SOCKET, SO_REUSEADDR, &yes, sizeof(yes));
+    if (server -> workerCount != 1) { // every worker binds the same port, and the kernel spreads connections
+        // between them. (Not with just the one, so that a second Sitix on the same port still fails to bind.)
+        setsockopt(listener, SOL_SOCKET, SO_REUSEPORT, &yes, sizeof(yes));
+    }
+    struct sockaddr_in where;
+    memset(&where, 0, sizeof(where));
+    where.sin_family = AF_INET;
+    where.sin_port = htons(server -> port);
+    if (inet_pton(AF_INET, server -> address.c_str(), &where.sin_addr) != 1) {
+        printf(ERROR "%s isn't an IPv4 address.\n", server -> address.c_str());
+        return false;
+    }
+    if (bind(listener, (struct sockaddr*)&where, sizeof(where)) != 0) {
+        printf(ERROR "Couldn't bind to %s:%d.\n", server -> address.c_str(), server -> port);
+        perror("\tbind");
+        return false;
+    }
+    if (listen(listener, SOMAXCONN) != 0) {
+        printf(ERROR "Couldn't listen on %s:%d.\n", server -> address.c_str(), server -> port);
+        perror("\tlisten");
+        return false;
+    }
+    epoll = epoll_create1(EPOLL_CLOEXEC);
+    wakeup = eventfd(0, EFD_NONBLOCK | EFD_CLOEXEC);
+    if (epoll == -1 || wakeup == -1) {
+        printf(ERROR "Couldn't set up the server's event loop.\n");
+        perror("\tepoll_create1/eventfd");
+        return false;
+    }
+    struct epoll_event event;
+    event.events = EPOLLIN;
+    event.data.fd = listener;
+    epoll_ctl(epoll, EPOLL_CTL_ADD, listener, &event);
+    event.data.fd = wakeup;
+    epoll_ctl(epoll, EPOLL_CTL_ADD, wakeup, &event);
+    tick();
+    return true;
+}
+
+void DynamoWorker::run() {
+    if (core >= 0) {
+        cpu_set_t only;
+        CPU_ZERO(&only);
+        CPU_SET(core, &only);
+        if (pthread_setaffinity_np(pthread_self(), sizeof(only), &only) != 0) {
+            printf(WARNING "Couldn't pin a server worker to core %d.\n", core);
+        }
+    }
+    view();
+    struct epoll_event events[256];
+    while (true) {
+        int count = epoll_wait(epoll, events, 256, 1000);
+        if (count == -1 && errno != EINTR) {
+            printf(ERROR "The server's event loop failed.\n");
+            perror("\tepoll_wait");
+            return;
+        }
+        tick();
+        view();
+        bool woken = false;
+        for (int i = 0; i < count; i ++) {
+            int fd = events[i].data.fd;
+            if (fd == listener) {
+                accept();
+            }
+            else if (fd == wakeup) {
+                wake();
+                woken = true;
+            }
+            else if ((size_t)fd < connections.size() && connections[fd] != NULL) {
+                DynamoConnection* connection = connections[fd];
+                connection -> active = now;
+                if (events[i].events & (EPOLLERR | EPOLLHUP)) {
+                    close(connection);
+                    continue;
+                }
+                if (events[i].events & EPOLLIN) {
+                    receive(connection); // (which might close it)
+                }
+                else if (events[i].events & EPOLLOUT) {
+                    if (!send(connection)) {
+                        close(connection);
+                    }
+                }
+            }
+        }
+        if (changes.size() > 0 || woken) { // (a poke might be invalidate() or mark(), with changes of their own waiting to go out)
+            publish();
+        }
+    }
+}
+
+void DynamoWorker::poke() {
+    uint64_t poke = 1;
+    write(wakeup, &poke, sizeof(poke));
+}
+
+void DynamoWorker::view() {
+    if (cache != NULL && server -> generation == generation) { // the usual case, and no lock needed to find that out
+        return;
+    }
+    std::lock_guard<std::mutex> lock(server -> m_mutex);
+    cache = server -> published;
+    generation = server -> generation;
+}
+
+void DynamoWorker::publish() {
+    server -> publish(changes);
+    unpublished.clear();
+    unpublishedDynamic.clear();
+    view();
+}
+
+void DynamoWorker::wake() {
+    uint64_t pokes;
+    while (read(wakeup, &pokes, sizeof(pokes)) > 0);
+    std::vector<DynamoRender> done;
+    std::vector<std::shared_ptr<DynamoStream>> streams;
+    {
+        std::lock_guard<std::mutex> lock(m_mutex);
+        done.swap(finished);
+        streams.swap(flowing);
+    }
+    for (std::shared_ptr<DynamoStream>& stream : streams) {
+        DynamoConnection* connection = stream -> connection; // (NULL if the response is already over, or the client's gone)
+        if (connection != NULL) {
+            connection -> active = now; // a long render isn't an idle connection
+            if (!send(connection)) {
+                close(connection);
+            }
+        }
+    }
+    for (DynamoRender& render : done) {
+        finish(render);
+    }
+}
+
+void DynamoWorker::accept() {
+    while (true) {
+        int fd = accept4(listener, NULL, NULL, SOCK_NONBLOCK | SOCK_CLOEXEC);
+        if (fd == -1) {
+            if (errno == EINTR || errno == ECONNABORTED) {
+                continue;
+            }
+            if (errno != EAGAIN && errno != EWOULDBLOCK) {
+                printf(WARNING "Couldn't accept a connection.\n");
+                perror("\taccept4");
+            }
+            return;
+        }
+        int yes = 1;
+        setsockopt(fd, IPPROTO_TCP, TCP_NODELAY, &yes, sizeof(yes)); // responses go out in one writev anyways, so Nagle only ever delays them
+        if ((size_t)fd >= connections.size()) {
+            connections.resize(fd + 1, NULL);
+        }
+        DynamoConnection* connection = new DynamoConnection;
+        connection -> fd = fd;
+        connection -> active = now;
+        connections[fd] = connection;
+        struct epoll_event event;
+        event.events = EPOLLIN | EPOLLOUT | EPOLLRDHUP | EPOLLET; // edge triggered, so each connection is registered exactly once
+        event.data.fd = fd;
+        epoll_ctl(epoll, EPOLL_CTL_ADD, fd, &event);
+    }
+}
+
+void DynamoWorker::receive(DynamoConnection* connection) {
+    char buffer[16 * 1024];
+    bool closed = false;
+    while (true) {
+        ssize_t got = read(connection -> fd, buffer, sizeof(buffer));
+        if (got > 0) {
+            connection -> in.append(buffer, got);
+            continue;
+        }
+        if (got == -1 && errno == EINTR) {
+            continue;
+        }
+        closed = got == 0 || (errno != EAGAIN && errno != EWOULDBLOCK);
+        break;
+    }
+    auto idle = [&]() {
+        return connection -> head.size() == 0 && connection -> body == NULL && connection -> file == -1 && connection -> awaiting.size() == 0
+            && connection -> stream == NULL;
+    };
+    if (idle()) { // (otherwise send() gets to it once the current response is out)
+        handle(connection);
+    }
+    bool open = send(connection);
+    if (!open || (closed && idle())) { // nothing left to answer, and nobody left to answer it to
+        close(connection);
+    }
+}
+
+bool DynamoWorker::send(DynamoConnection* connection) {
+    while (true) {
+        if (connection -> awaiting.size() > 0) { // nothing to send until the render's done
+            return true;
+        }
+        size_t bodySize = connection -> body == NULL ? 0 : connection -> body -> size();
+        size_t total = connection -> head.size() + bodySize;
+        if (connection -> sent < total) {
+            struct iovec parts[2];
+            int count = 0;
+            if (connection -> sent < connection -> head.size()) {
+                parts[count].iov_base = connection -> head.data() + connection -> sent;
+                parts[count].iov_len = connection -> head.size() - connection -> sent;
+                count ++;
+            }
+            if (bodySize > 0) {
+                size_t into = connection -> sent > connection -> head.size() ? connection -> sent - connection -> head.size() : 0;
+                parts[count].iov_base = (void*)(connection -> body -> data() + into);
+                parts[count].iov_len = bodySize - into;
+                count ++;
+            }
+            ssize_t wrote = writev(connection -> fd, parts, count);
+            if (wrote == -1) {
+                if (errno == EINTR) {
+                    continue;
+                }
+                return errno == EAGAIN || errno == EWOULDBLOCK; // full: EPOLLOUT brings us back
+            }
+            connection -> sent += wrote;
+            continue;
+        }
+        if (connection -> file != -1 && connection -> offset < connection -> length) {
+            ssize_t wrote = sendfile(connection -> fd, connection -> file, &connection -> offset, connection -> length - connection -> offset);
+            if (wrote == -1) {
+                if (errno == EINTR) {
+                    continue;
+                }
+                return errno == EAGAIN || errno == EWOULDBLOCK;
+            }
+            if (wrote == 0) { // the file got shorter underneath us. The Content-Length is a lie now, so the connection can't be reused.
+                return false;
+            }
+            continue;
+        }
+        // the response is completely out (or, streaming, the latest piece of it is)
+        connection -> head.clear();
+        connection -> body.reset();
+        connection -> sent = 0;
+        if (connection -> file != -1) {
+            ::close(connection -> file);
+            connection -> file = -1;
+        }
+        if (connection -> stream != NULL) {
+            int more = pull(connection);
+            if (more == 1) {
+                continue;
+            }
+            if (more == 0) { // the render pokes us when it's made more
+                return true;
+            }
+            if (more == -2) {
+                return false;
+            }
+        }
+        if (!connection -> keepAlive) {
+            return false;
+        }
+        if (!handle(connection)) { // and nothing else has been asked for yet
+            return true;
+        }
+    }
+}
+
+bool DynamoWorker::handle(DynamoConnection* connection) {
+    std::string& in = connection -> in;
+    size_t end = in.find("\r\n\r\n");
+    if (end == std::string::npos) {
+        if (in.size() > server -> maxHeader) {
+            connection -> keepAlive = false;
+            in.clear();
+            status(connection, 431);
+            return true;
+        }
+        return false;
+    }
+    size_t lineEnd = in.find("\r\n");
+    std::string line = in.substr(0, lineEnd);
+    size_t space = line.find(' ');
+    size_t space2 = space == std::string::npos ? std::string::npos : line.find(' ', space + 1);
+    if (space2 == std::string::npos) {
+        connection -> keepAlive = false;
+        in.clear();
+        status(connection, 400);
+        return true;
+    }
+    std::string method = line.substr(0, space);
+    connection -> headOnly = method == "HEAD";
+    std::string target = line.substr(space + 1, space2 - space - 1);
+    std::string version = line.substr(space2 + 1);
+    std::unordered_map<std::string, std::string> headers;
+    size_t at = lineEnd + 2;
+    while (at < end) {
+        size_t next = in.find("\r\n", at);
+        size_t colon = in.find(':', at);
+        if (colon != std::string::npos && colon < next) {
+            std::string name = in.substr(at, colon - at);
+            for (char& c : name) {
+                c = tolower(c);
+            }
+            size_t value = in.find_first_not_of(" \t", colon + 1);
+            headers[name] = value >= next ? "" : in.substr(value, next - value);
+        }
+        at = next + 2;
+    }
+    size_t bodyLength = 0; // GET and HEAD don't have bodies, but if a client sends one anyways it has to be skipped to find the next request
+    auto length = headers.find("content-length");
+    if (length != headers.end()) {
+        bodyLength = strtoul(length -> second.c_str(), NULL, 10);
+    }
+    if (headers.contains("transfer-encoding")) { // a chunked request body. We've no use for one, and no way to know where the next request starts.
+        connection -> keepAlive = false;
+        in.clear();
+        status(connection, 501);
+        return true;
+    }
+    if (in.size() < end + 4 + bodyLength) {
+        return false;
+    }
+    in.erase(0, end + 4 + bodyLength);
+    std::string connectionHeader;
+    auto wanted = headers.find("connection");
+    if (wanted != headers.end()) {
+        connectionHeader = wanted -> second;
+        for (char& c : connectionHeader) {
+            c = tolower(c);
+        }
+    }
+    connection -> chunkable = version == "HTTP/1.1";
+    if (version == "HTTP/1.1") {
+        connection -> keepAlive = connectionHeader.find("close") == std::string::npos;
+    }
+    else if (version == "HTTP/1.0") {
+        connection -> keepAlive = connectionHeader.find("keep-alive") != std::string::npos;
+    }
+    else {
+        connection -> keepAlive = false;
+        status(connection, 505);
+        return true;
+    }
+    respond(connection, method, target, headers);
+    return true;
+}
+
+void DynamoWorker::respond(DynamoConnection* connection, std::string method, std::string target, std::unordered_map<std::string, std::string>& headers) {
+    if (method != "GET" && !connection -> headOnly) {
+        status(connection, 405, "Allow: GET, HEAD\r\n");
+        return;
+    }
+    std::string raw = target.substr(0, target.find_first_of("?#"));
+    if (raw.size() == 0 || raw[0] != '/') {
+        status(connection, 400);
+        return;
+    }
+    std::string decoded;
+    for (size_t i = 0; i < raw.size(); i ++) {
+        if (raw[i] == '%') {
+            int high = i + 2 < raw.size() ? hexValue(raw[i + 1]) : -1;
+            int low = i + 2 < raw.size() ? hexValue(raw[i + 2]) : -1;
+            if (high == -1 || low == -1 || (high == 0 && low == 0)) {
+                status(connection, 400);
+                return;
+            }
+            decoded += (char)(high * 16 + low);
+            i += 2;
+        }
+        else {
+            decoded += raw[i];
+        }
+    }
+    std::string key; // decoded, with empty segments squashed out
+    size_t at = 1;
+    while (at <= decoded.size()) {
+        size_t end = decoded.find('/', at);
+        if (end == std::string::npos) {
+            end = decoded.size();
+        }
+        if (end > at) {
+            if (decoded[at] == '.') { // .., and dotfiles like .sitix-manifest that aren't part of the site
+                status(connection, 404);
+                return;
+            }
+            if (key.size() > 0) {
+                key += '/';
+            }
+            key += decoded.substr(at, end - at);
+        }
+        at = end + 1;
+    }
+    bool directory = decoded.back() == '/';
+    if (directory) {
+        key += key.size() == 0 ? "index.html" : "/index.html";
+    }
+    auto request = [&]() { // (only put together for renders; static files don't need it)
+        size_t question = target.find('?');
+        std::string query = question == std::string::npos ? "" : target.substr(question + 1, target.find('#', question) - question - 1);
+        return DynamoRequest { method, decoded, Dynamo::parseQuery(query), headers };
+    };
+    if (server -> renderer && isDynamic(key)) {
+        DynamoRequest asked = request();
+        renderFor(connection, key, asked);
+        return;
+    }
+    DynamoFile* file = find(key);
+    if (file == NULL && rendering.contains(key)) {
+        DynamoRequest asked = request();
+        render(connection, key, asked);
+        return;
+    }
+    struct stat sb;
+    int fd = -1;
+    if (file == NULL) {
+        uint64_t since = server -> epoch; // (before it's opened: an invalidation from after this might have been for a change we read anyways)
+        fd = open((server -> root + "/" + key).c_str(), O_RDONLY | O_CLOEXEC);
+        if (fd == -1) {
+            status(connection, errno == EACCES ? 403 : (errno == ENOENT || errno == ENOTDIR || errno == ENAMETOOLONG) ? 404 : 500);
+            return;
+        }
+        if (fstat(fd, &sb) != 0) {
+            ::close(fd);
+            status(connection, 500);
+            return;
+        }
+        if (S_ISDIR(sb.st_mode) && !directory) { // the page's relative links only work from inside the directory
+            ::close(fd);
+            std::string query = target.size() > raw.size() ? target.substr(raw.size()) : "";
+            status(connection, 301, "Location: " + raw + "/" + query + "\r\n");
+            return;
+        }
+        if (!S_ISREG(sb.st_mode)) {
+            ::close(fd);
+            status(connection, 404);
+            return;
+        }
+        if (server -> onDemand) {
+            server -> watch(key); // (before anything's read, so that no change after this can be missed)
+            char magic[3];
+            if (pread(fd, magic, 3, 0) == 3 && magic[0] == '[' && (magic[1] == '!' || magic[1] == '?') && magic[2] == ']') { // it's a Sitix file
+                ::close(fd);
+                if (magic[1] == '?') { // templates aren't pages
+                    status(connection, 404);
+                    return;
+                }
+                DynamoRequest asked = request();
+                render(connection, key, asked);
+                return;
+            }
+        }
+        if ((size_t)sb.st_size <= server -> maxCachedFile) {
+            file = load(key, sb, fd, since);
+            ::close(fd);
+            fd = -1;
+            if (file == NULL) {
+                status(connection, 500);
+                return;
+            }
+        }
+    }
+    if (file != NULL) {
+        serve(connection, file, headers);
+        return;
+    }
+    if (!reply(connection, etagFor(sb), httpDate(sb.st_mtim.tv_sec), sb.st_mtim.tv_sec, contentType(key), sb.st_size, headers)) {
+        ::close(fd);
+        return;
+    }
+    posix_fadvise(fd, 0, 0, POSIX_FADV_SEQUENTIAL);
+    connection -> file = fd;
+    connection -> offset = 0;
+    connection -> length = sb.st_size;
+}
+
+std::vector<std::pair<std::string, std::string>> Dynamo::parseQuery(std::string query) {
+    std::vector<std::pair<std::string, std::string>> ret;
+    auto decode = [](std::string part) {
+        std::string decoded;
+        for (size_t i = 0; i < part.size(); i ++) {
+            if (part[i] == '+') {
+                decoded += ' ';
+            }
+            else if (part[i] == '%' && i + 2 < part.size() && hexValue(part[i + 1]) != -1 && hexValue(part[i + 2]) != -1) {
+                char c = hexValue(part[i + 1]) * 16 + hexValue(part[i + 2]);
+                if (c != 0) { // (a NUL would only cut things short further along)
+                    decoded += c;
+                }
+                i += 2;
+            }
+            else {
+                decoded += part[i]; // including a stray %, which is what browsers do too
+            }
+        }
+        return decoded;
+    };
+    for (std::string& pair : split(query, '&')) {
+        size_t equals = pair.find('=');
+        if (equals == std::string::npos) {
+            ret.push_back({ decode(pair), "" });
+        }
+        else {
+            ret.push_back({ decode(pair.substr(0, equals)), decode(pair.substr(equals + 1)) });
+        }
+    }
+    return ret;
+}
+
+DynamoFile* DynamoWorker::find(std::string& path) {
+    auto mine = unpublished.find(path);
+    if (mine != unpublished.end()) {
+        return mine -> second.get();
+    }
+    const DynamoShard& shard = cache -> shard(path);
+    auto cached = shard.files.find(path);
+    if (cached == shard.files.end()) {
+        return NULL;
+    }
+    if (cached -> second -> used != now) { // (not every hit: it's the one cache line every worker would be writing to)
+        cached -> second -> used = now;
+    }
+    return cached -> second.get();
+}
+
+bool DynamoWorker::isDynamic(std::string& path) {
+    auto mine = unpublishedDynamic.find(path);
+    if (mine != unpublishedDynamic.end()) {
+        return mine -> second;
+    }
+    return cache -> shard(path).dynamic.contains(path);
+}
+
+bool DynamoWorker::reply(DynamoConnection* connection, std::string etag, std::string lastModified, time_t mtime, const char* type, size_t size,
+    std::unordered_map<std::string, std::string>& headers) {
+    bool unchanged = notModified(headers, etag, mtime);
+    std::string& head = connection -> head;
+    head = "HTTP/1.1 ";
+    head += unchanged ? "304 Not Modified" : "200 OK";
+    head += "\r\nServer: Sitix/" SITIX_VERSION "\r\nDate: " + date + "\r\nETag: " + etag + "\r\nLast-Modified: " + lastModified + "\r\n";
+    if (!unchanged) {
+        head += "Content-Type: ";
+        head += type;
+        head += "\r\nContent-Length: " + std::to_string(size) + "\r\n";
+    }
+    head += connection -> keepAlive ? "Connection: keep-alive\r\n\r\n" : "Connection: close\r\n\r\n";
+    return !unchanged && !connection -> headOnly;
+}
+
+void DynamoWorker::serve(DynamoConnection* connection, DynamoFile* file, std::unordered_map<std::string, std::string>& headers) {
+    if (reply(connection, file -> etag, file -> lastModified, file -> mtime, file -> type, file -> body -> size(), headers)) {
+        connection -> body = file -> body;
+    }
+}
+
+void DynamoWorker::status(DynamoConnection* connection, int code, std::string extra) {
+    std::string body = "<!DOCTYPE html>\n<html><head><title>" + std::to_string(code) + " " + reason(code) + "</title></head><body><h1>"
+        + std::to_string(code) + " " + reason(code) + "</h1><hr>Sitix Dynamo</body></html>\n";
+    connection -> head = "HTTP/1.1 " + std::to_string(code) + " " + reason(code) + "\r\nServer: Sitix/" SITIX_VERSION "\r\nDate: " + date + "\r\n" + extra
+        + "Content-Type: text/html; charset=utf-8\r\nContent-Length: " + std::to_string(body.size()) + "\r\n"
+        + (connection -> keepAlive ? "Connection: keep-alive\r\n\r\n" : "Connection: close\r\n\r\n");
+    if (!connection -> headOnly) {
+        connection -> body = std::make_shared<const std::string>(std::move(body));
+    }
+}
+
+void DynamoWorker::render(DynamoConnection* connection, std::string path, DynamoRequest& request) {
+    auto [waiters, first] = rendering.try_emplace(path);
+    waiters -> second.push_back(DynamoWaiter { connection, request });
+    connection -> awaiting = path;
+    if (first) {
+        submit(path, path, request);
+    }
+}
+
+void DynamoWorker::renderFor(DynamoConnection* connection, std::string path, DynamoRequest& request) {
+    if (connection -> chunkable && !connection -> headOnly) {
+        std::shared_ptr<DynamoStream> stream = std::make_shared<DynamoStream>();
+        stream -> connection = connection;
+        stream -> type = contentType(path);
+        connection -> stream = stream;
+        submit("", path, request, stream);
+        return;
+    }
+    std::string key = "\n" + std::to_string(oneOffs ++); // (no path has a newline in it)
+    rendering[key].push_back(DynamoWaiter { connection, request });
+    connection -> awaiting = key;
+    submit(key, path, request);
+}
+
+void DynamoWorker::submit(std::string key, std::string path, DynamoRequest& request, std::shared_ptr<DynamoStream> stream) {
+    uint64_t since = server -> epoch;
+    server -> pool.submit([this, key, path, since, request, stream]() mutable {
+        DynamoRender done;
+        done.key = key;
+        done.path = path;
+        done.since = since;
+        if (stream != NULL) {
+            ChunkedWriteOutput out(this, stream);
+            done.ok = server -> renderer(path, request, out, done.dynamic);
+            out.finish(done.ok);
+        }
+        else {
+            StringWriteOutput out;
+            done.ok = server -> renderer(path, request, out, done.dynamic);
+            done.body = std::move(out.content);
+        }
+        {
+            std::lock_guard<std::mutex> lock(m_mutex);
+            finished.push_back(std::move(done));
+        }
+        poke();
+    });
+}
+
+int DynamoWorker::pull(DynamoConnection* connection) {
+    std::shared_ptr<DynamoStream> stream = connection -> stream; // (keeping it alive, since it might be let go of in here)
+    std::lock_guard<std::mutex> lock(stream -> m_mutex);
+    stream -> queued -= connection -> pulled;
+    connection -> pulled = 0;
+    if (stream -> cancelled) {
+        return -2;
+    }
+    if (stream -> chunks.size() == 0) {
+        if (!stream -> done) {
+            return 0;
+        }
+        stream -> connection = NULL;
+        connection -> stream.reset();
+        if (stream -> failed) {
+            if (stream -> started) { // it can't be a 404 now, and the chunked body can't be ended properly either
+                return -2;
+            }
+            status(connection, 404);
+            return 1;
+        }
+        return -1;
+    }
+    if (!stream -> started) {
+        stream -> started = true;
+        connection -> head = "HTTP/1.1 200 OK\r\nServer: Sitix/" SITIX_VERSION "\r\nDate: " + date + "\r\nCache-Control: no-store\r\nContent-Type: "
+            + stream -> type + "\r\nTransfer-Encoding: chunked\r\n" + (connection -> keepAlive ? "Connection: keep-alive\r\n\r\n" : "Connection: close\r\n\r\n");
+    }
+    connection -> pulled = stream -> chunks.front().size();
+    connection -> body = std::make_shared<const std::string>(std::move(stream -> chunks.front()));
+    stream -> chunks.pop_front();
+    return 1;
+}
+
+void DynamoWorker::finish(DynamoRender& render) {
+    std::vector<DynamoWaiter> waiters;
+    auto waiting = rendering.find(render.key);
+    if (waiting != rendering.end()) {
+        waiters = std::move(waiting -> second);
+        rendering.erase(waiting);
+    }
+    bool oneOff = render.key != render.path;
+    if (render.dynamic != isDynamic(render.path)) { // it's just become a dynamo page (or just stopped being one)
+        unpublishedDynamic[render.path] = render.dynamic;
+        changes.push_back(DynamoChange { render.dynamic ? DynamoChange::Dynamic : DynamoChange::Static, render.path });
+    }
+    if (render.key.size() == 0) { // it was streamed, so the client's already got it
+        return;
+    }
+    if (render.dynamic && !oneOff) { // we didn't know it was a dynamo page until it was rendered. The render was for the first request that
+        // wanted it, but everyone gets their own, so it isn't any use.
+        for (DynamoWaiter& waiter : waiters) {
+            waiter.connection -> awaiting.clear();
+            renderFor(waiter.connection, render.path, waiter.request);
+            if (!send(waiter.connection)) { // (a one-off is still waiting, but a stream might have something already)
+                close(waiter.connection);
+            }
+        }
+        return;
+    }
+    if (oneOff) {
+        for (DynamoWaiter& waiter : waiters) { // (just the one, or none if it hung up)
+            DynamoConnection* connection = waiter.connection;
+            connection -> awaiting.clear();
+            if (render.ok) {
+                fresh(connection, render.body, contentType(render.path));
+            }
+            else {
+                status(connection, 404);
+            }
+            if (!send(connection)) {
+                close(connection);
+            }
+        }
+        return;
+    }
+    DynamoFile* file = NULL;
+    if (render.ok) {
+        std::string etag = "\"" + Hasher::hex(Hasher::of(render.body.data(), render.body.size())) + "\"";
+        file = store(render.path, std::move(render.body), etag, now, render.since);
+    }
+    for (DynamoWaiter& waiter : waiters) {
+        DynamoConnection* connection = waiter.connection;
+        connection -> awaiting.clear();
+        if (file != NULL) {
+            serve(connection, file, waiter.request.headers);
+        }
+        else {
+            status(connection, 404);
+        }
+        if (!send(connection)) {
+            close(connection);
+        }
+    }
+}
+
+void DynamoWorker::fresh(DynamoConnection* connection, std::string& body, const char* type) {
+    connection -> head = "HTTP/1.1 200 OK\r\nServer: Sitix/" SITIX_VERSION "\r\nDate: " + date + "\r\nCache-Control: no-store\r\nContent-Type: " + type
+        + "\r\nContent-Length: " + std::to_string(body.size()) + "\r\n" + (connection -> keepAlive ? "Connection: keep-alive\r\n\r\n" : "Connection: close\r\n\r\n");
+    if (!connection -> headOnly) {
+        connection -> body = std::make_shared<const std::string>(std::move(body));
+    }
+}
+
+DynamoFile* DynamoWorker::load(std::string path, struct stat& sb, int fd, uint64_t since) {
+    std::string content;
+    content.resize(sb.st_size);
+    size_t done = 0;
+    while (done < content.size()) {
+        ssize_t got = read(fd, content.data() + done, content.size() - done);
+        if (got == -1 && errno == EINTR) {
+            continue;
+        }
+        if (got <= 0) {
+            break;
+        }
+        done += got;
+    }
+    if (done != content.size()) { // it changed size while we were reading it. The next rebuild will invalidate it, but don't cache a torn read.
+        return NULL;
+    }
+    return store(path, std::move(content), etagFor(sb), sb.st_mtim.tv_sec, since);
+}
+
+DynamoFile* DynamoWorker::store(std::string path, std::string&& content, std::string etag, time_t mtime, uint64_t since) {
+    std::shared_ptr<DynamoFile> file = std::make_shared<DynamoFile>();
+    file -> body = std::make_shared<const std::string>(std::move(content));
+    file -> etag = etag;
+    file -> mtime = mtime;
+    file -> lastModified = httpDate(file -> mtime);
+    file -> type = contentType(path);
+    file -> used = now;
+    unpublished[path] = file; // (replacing whatever's there, once it's published)
+    changes.push_back(DynamoChange { DynamoChange::Store, path, file, since });
+    return file.get();
+}
+
+void DynamoWorker::close(DynamoConnection* connection) {
+    if (connection -> awaiting.size() > 0) { // the render carries on (somebody else will probably want the page), but there's nobody to give it to
+        std::vector<DynamoWaiter>& waiters = rendering[connection -> awaiting];
+        for (size_t i = 0; i < waiters.size(); i ++) {
+            if (waiters[i].connection == connection) {
+                waiters.erase(waiters.begin() + i);
+                break;
+            }
+        }
+    }
+    if (connection -> stream != NULL) { // stop the render bothering with us
+        std::lock_guard<std::mutex> lock(connection -> stream -> m_mutex);
+        connection -> stream -> cancelled = true;
+        connection -> stream -> connection = NULL;
+    }
+    connections[connection -> fd] = NULL;
+    ::close(connection -> fd); // (closing it takes it out of the epoll set too)
+    if (connection -> file != -1) {
+        ::close(connection -> file);
+    }
+    delete connection;
+}
+
+void DynamoWorker::tick() {
+    time_t current = time(NULL);
+    if (current == now) {
+        return;
+    }
+    now = current;
+    date = httpDate(now);
+    for (DynamoConnection* connection : connections) {
+        if (connection != NULL && now - connection -> active > server -> idleTimeout) {
+            close(connection);
+        }
+    }
+}
+
+
+ChunkedWriteOutput::ChunkedWriteOutput(DynamoWorker* loop, std::shared_ptr<DynamoStream> to) {
+    server = loop -> server;
+    worker = loop;
+    stream = to;
+}
+
+void ChunkedWriteOutput::write(const char* data, size_t length) {
+    if (stream -> cancelled) { // nobody to send it to. (The render carries on, but it's only burning a little CPU.)
+        return;
+    }
+    if (buffer.size() == 0) {
+        since = std::chrono::steady_clock::now();
+    }
+    buffer.append(data, length);
+    if (buffer.size() >= server -> flushBytes || std::chrono::steady_clock::now() - since >= std::chrono::milliseconds(server -> flushMillis)) {
+        flush();
+    }
+}
+
+void ChunkedWriteOutput::flush(bool last) {
+    std::string chunk;
+    if (buffer.size() > 0) {
+        char size[32];
+        snprintf(size, sizeof(size), "%zx\r\n", buffer.size());
+        chunk.reserve(buffer.size() + 32);
+        chunk += size;
+        chunk += buffer;
+        chunk += "\r\n";
+        buffer.clear();
+    }
+    if (last) {
+        chunk += "0\r\n\r\n";
+    }
+    if (chunk.size() == 0) {
+        return;
+    }
+    {
+        std::lock_guard<std::mutex> lock(stream -> m_mutex);
+        if (stream -> queued > 0 && stream -> queued + chunk.size() > server -> maxStreamed) { // the client's hopelessly far behind. Never wait for
+            // it: we're holding the session, so the watch loop (and everyone else on the pool) would be waiting too. The loop drops the connection.
+            stream -> cancelled = true;
+        }
+        if (!stream -> cancelled) {
+            stream -> queued += chunk.size();
+            stream -> chunks.push_back(std::move(chunk));
+        }
+        if (last) {
+            stream -> done = true;
+        }
+    }
+    {
+        std::lock_guard<std::mutex> lock(worker -> m_mutex);
+        worker -> flowing.push_back(stream);
+    }
+    worker -> poke();
+}
+
+void ChunkedWriteOutput::finish(bool ok) {
+    if (ok) {
+        flush(true);
+        return;
+    }
+    {
+        std::lock_guard<std::mutex> lock(stream -> m_mutex);
+        stream -> done = true;
+        stream -> failed = true;
+    }
+    {
+        std::lock_guard<std::mutex> lock(worker -> m_mutex);
+        worker -> flowing.push_back(stream);
+    }
+    worker -> poke();
+}
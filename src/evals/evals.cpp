@@ -65,31 +65,32 @@ EvalsObject* EvalsSession::render(MapView data, Session* sitix) { // all Evals c
     // this speeds things up and allows using lua in exciting new ways (like defining sitix variables as lua functions)
 
     // setup: loading the chunk to lua
+    lua_State* lua = sitix -> lua();
     std::string toLua = "return " + data.toString() + ";";
-    if (luaL_loadbuffer(sitix -> lua, toLua.c_str(), toLua.size(), "Evals blob") == LUA_ERRSYNTAX) {
+    if (luaL_loadbuffer(lua, toLua.c_str(), toLua.size(), "Evals blob") == LUA_ERRSYNTAX) {
         printf(ERROR "Syntax error in a Lua embedded blob!\n");
         // todo: actually print out the lua error
         return new ErrorObject();
     }
 
     // housekeeping: loading the useful objects to scope
-    lua_pushlightuserdata(sitix -> lua, parent);
-    lua_setglobal(sitix -> lua, "_sitix_parent");
-    lua_pushlightuserdata(sitix -> lua, scope);
-    lua_setglobal(sitix -> lua, "_sitix_scope");
+    lua_pushlightuserdata(lua, parent);
+    lua_setglobal(lua, "_sitix_parent");
+    lua_pushlightuserdata(lua, scope);
+    lua_setglobal(lua, "_sitix_scope");
 
     // calling: actually call the sitix chunk, and return the result as an Evals object
-    lua_pcall(sitix -> lua, 0, 1, 0);
-    int top = lua_gettop(sitix -> lua);
-    switch (lua_type(sitix -> lua, top)) {
+    lua_pcall(lua, 0, 1, 0);
+    int top = lua_gettop(lua);
+    switch (lua_type(lua, top)) {
         case LUA_TNUMBER:
-            return new NumberObject(lua_tonumber(sitix -> lua, top));
+            return new NumberObject(lua_tonumber(lua, top));
             break;
         case LUA_TSTRING:
-            return new StringObject(std::string{lua_tostring(sitix -> lua, top)});
+            return new StringObject(std::string{lua_tostring(lua, top)});
             break;
         case LUA_TBOOLEAN:
-            return new BooleanObject(lua_toboolean(sitix -> lua, top));
+            return new BooleanObject(lua_toboolean(lua, top));
             break;
         default:
             return new BooleanObject(false);
@@ -105,4 +106,10 @@ void EvalsBlob::render(SitixWriter* out, Object* scope, bool dereference) {
     EvalsObject* result = session.render(data, sitix);
     out -> write(result -> toString());
     delete result;
-}
\ No newline at end of file
+}
+
+Node* EvalsBlob::clone() {
+    EvalsBlob* ret = new EvalsBlob(*this);
+    ret -> parent = NULL;
+    return ret;
+}
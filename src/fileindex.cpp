@@ -0,0 +1,386 @@
+// definitions for FileIndex
+
+#include <fileindex.hpp>
+#include <fts.h>
+#include <algorithm>
+#include <cstring>
+#include <cstdio>
+#include <dirent.h>
+#include <fcntl.h>
+#include <unistd.h>
+#include <iouring.hpp>
+
+
+static int ftsCompare(const FTSENT** one, const FTSENT** two) { // visit directory entries in name order, so the walk (and thus the build) is deterministic
+    return strcmp((*one) -> fts_name, (*two) -> fts_name);
+}
+
+static std::string parentOf(std::string key) { // "" is the parent of top-level entries
+    size_t slash = key.rfind('/');
+    if (slash == std::string::npos) {
+        return "";
+    }
+    return key.substr(0, slash);
+}
+
+
+FileIndex::FileIndex(std::string rdir) {
+    dir = rdir;
+}
+
+bool FileIndex::normalize(std::string& path) { // collapses duplicate slashes and . segments. .. segments could escape the directory, so we refuse them.
+    std::string ret;
+    ret.reserve(path.size());
+    size_t i = 0;
+    while (i < path.size()) {
+        size_t segEnd = path.find('/', i);
+        if (segEnd == std::string::npos) {
+            segEnd = path.size();
+        }
+        size_t segLen = segEnd - i;
+        if (segLen == 2 && path[i] == '.' && path[i + 1] == '.') {
+            return false;
+        }
+        if (segLen > 0 && !(segLen == 1 && path[i] == '.')) {
+            if (ret.size() > 0) {
+                ret += '/';
+            }
+            ret.append(path, i, segLen);
+        }
+        i = segEnd + 1;
+    }
+    path = ret;
+    return true;
+}
+
+std::string FileIndex::relative(std::string path) {
+    std::string key;
+    if (dir.size() == 0) {
+        key = path;
+    }
+    else if (path.size() <= dir.size()) {
+        key = "";
+    }
+    else {
+        key = path.substr(dir.size());
+    }
+    normalize(key);
+    return key;
+}
+
+std::string FileIndex::absolute(std::string key) {
+    if (key.size() == 0) {
+        return dir;
+    }
+    if (dir.size() == 0 || dir.back() == '/') {
+        return dir + key;
+    }
+    return dir + '/' + key;
+}
+
+static void statxToStat(const struct statx* sx, struct stat* sb) { // insert() only looks at the type, size and mtime
+    memset(sb, 0, sizeof(struct stat));
+    sb -> st_mode = sx -> stx_mode;
+    sb -> st_size = sx -> stx_size;
+    sb -> st_mtim.tv_sec = sx -> stx_mtime.tv_sec;
+    sb -> st_mtim.tv_nsec = sx -> stx_mtime.tv_nsec;
+}
+
+
+void FileIndex::scan(std::string path, std::vector<std::string>* files, std::vector<std::string>* dirs) {
+    IoUring& ring = IoUring::local();
+    if (ring.init() && ring.supports({ IORING_OP_STATX })) {
+        struct stat sb;
+        if (lstat(path.c_str(), &sb) != 0) {
+            printf(ERROR "Couldn't initiate directory traversal.\n");
+            perror("\tlstat");
+            return;
+        }
+        insert(relative(path), &sb);
+        if (S_ISDIR(sb.st_mode)) {
+            if (dirs != NULL) {
+                dirs -> push_back(path);
+            }
+            scanBatched(ring, path, files, dirs);
+        }
+        else if (S_ISREG(sb.st_mode) && files != NULL) {
+            files -> push_back(path);
+        }
+        return;
+    }
+    char* roots[] = { (char*)path.c_str(), NULL };
+    FTS* ftsp = fts_open(roots, FTS_PHYSICAL | FTS_NOCHDIR, ftsCompare);
+    if (ftsp == NULL) {
+        printf(ERROR "Couldn't initiate directory traversal.\n");
+        perror("\tfts_open");
+        return;
+    }
+    FTSENT* ent;
+    while ((ent = fts_read(ftsp)) != NULL) {
+        if (ent -> fts_info == FTS_DP) { // postorder visit of a directory we've already seen
+            continue;
+        }
+        std::string key = relative(ent -> fts_path);
+        if (ent -> fts_info == FTS_NS || ent -> fts_info == FTS_DNR || ent -> fts_info == FTS_ERR) {
+            IndexedPath& broken = paths[key];
+            broken.type = FileMan::PathState::Error;
+            continue;
+        }
+        insert(key, ent -> fts_statp);
+        if (ent -> fts_info == FTS_F && files != NULL) {
+            files -> push_back(ent -> fts_path);
+        }
+        else if (ent -> fts_info == FTS_D && dirs != NULL) {
+            dirs -> push_back(ent -> fts_path);
+        }
+    }
+    fts_close(ftsp);
+}
+
+void FileIndex::scanBatched(IoUring& ring, std::string path, std::vector<std::string>* files, std::vector<std::string>* dirs) {
+    // visits things in exactly the same order FTS does (preorder, siblings sorted by name), so the render queue doesn't change
+    int dirfd = open(path.c_str(), O_RDONLY | O_DIRECTORY | O_CLOEXEC);
+    if (dirfd == -1) {
+        paths[relative(path)].type = FileMan::PathState::Error;
+        return;
+    }
+    DIR* d = fdopendir(dirfd);
+    if (d == NULL) {
+        close(dirfd);
+        paths[relative(path)].type = FileMan::PathState::Error;
+        return;
+    }
+    std::vector<std::string> names;
+    struct dirent* entry;
+    while ((entry = readdir(d)) != NULL) {
+        if (strcmp(entry -> d_name, ".") == 0 || strcmp(entry -> d_name, "..") == 0) {
+            continue;
+        }
+        names.push_back(entry -> d_name);
+    }
+    std::sort(names.begin(), names.end());
+    std::vector<struct statx> stats(names.size());
+    std::vector<int> results;
+    ring.batch(names.size(), [&](struct io_uring_sqe* sqe, size_t i) { // one submission stats the whole directory
+        sqe -> opcode = IORING_OP_STATX;
+        sqe -> fd = dirfd;
+        sqe -> addr = (unsigned long)names[i].c_str();
+        sqe -> len = STATX_TYPE | STATX_MODE | STATX_SIZE | STATX_MTIME;
+        sqe -> off = (unsigned long)&stats[i];
+        sqe -> statx_flags = AT_SYMLINK_NOFOLLOW;
+    }, results);
+    closedir(d); // closes dirfd too
+    std::string prefix = path;
+    if (prefix.size() == 0 || prefix.back() != '/') {
+        prefix += '/';
+    }
+    for (size_t i = 0; i < names.size(); i ++) {
+        std::string full = prefix + names[i];
+        std::string key = relative(full);
+        if (results[i] < 0) {
+            paths[key].type = FileMan::PathState::Error;
+            continue;
+        }
+        struct stat sb;
+        statxToStat(&stats[i], &sb);
+        insert(key, &sb);
+        if (S_ISDIR(sb.st_mode)) {
+            if (dirs != NULL) {
+                dirs -> push_back(full);
+            }
+            scanBatched(ring, full, files, dirs);
+        }
+        else if (S_ISREG(sb.st_mode) && files != NULL) {
+            files -> push_back(full);
+        }
+    }
+}
+
+void FileIndex::insert(std::string key, const struct stat* sb) {
+    IndexedPath& entry = paths[key];
+    if (S_ISDIR(sb -> st_mode)) {
+        entry.type = FileMan::PathState::Directory;
+    }
+    else {
+        entry.children.clear();
+        entry.type = S_ISREG(sb -> st_mode) ? FileMan::PathState::File : FileMan::PathState::Other;
+    }
+    entry.size = sb -> st_size;
+    entry.mtime = sb -> st_mtim;
+    if (key.size() == 0) { // the root has no parent to link into
+        return;
+    }
+    auto parent = paths.find(parentOf(key));
+    if (parent != paths.end()) {
+        std::string name = key.substr(key.rfind('/') + 1); // if there's no slash, npos + 1 wraps around to 0
+        std::vector<std::string>& siblings = parent -> second.children;
+        auto at = std::lower_bound(siblings.begin(), siblings.end(), name);
+        if (at == siblings.end() || *at != name) {
+            siblings.insert(at, name);
+        }
+    }
+}
+
+void FileIndex::refresh(std::string path) {
+    struct stat sb;
+    if (lstat(path.c_str(), &sb) != 0) {
+        remove(path);
+        return;
+    }
+    std::string key = relative(path);
+    IndexedPath* existing = find(key);
+    if (S_ISDIR(sb.st_mode) && (existing == NULL || existing -> type != FileMan::PathState::Directory)) {
+        scan(path); // a directory that was moved in might already have things in it
+    }
+    else {
+        insert(key, &sb);
+    }
+}
+
+void FileIndex::remove(std::string path) {
+    std::string key = relative(path);
+    std::vector<std::string> doomed { key };
+    while (doomed.size() > 0) {
+        std::string k = doomed.back();
+        doomed.pop_back();
+        auto it = paths.find(k);
+        if (it == paths.end()) {
+            continue;
+        }
+        for (std::string& child : it -> second.children) {
+            doomed.push_back(k.size() == 0 ? child : k + '/' + child);
+        }
+        paths.erase(it);
+    }
+    if (key.size() > 0) {
+        auto parent = paths.find(parentOf(key));
+        if (parent != paths.end()) {
+            std::string name = key.substr(key.rfind('/') + 1);
+            std::vector<std::string>& siblings = parent -> second.children;
+            auto at = std::lower_bound(siblings.begin(), siblings.end(), name);
+            if (at != siblings.end() && *at == name) {
+                siblings.erase(at);
+            }
+        }
+    }
+}
+
+void FileIndex::resync(std::vector<std::string>& files, std::vector<std::string>& dirs, std::vector<std::string>& removed) {
+    std::vector<std::string> keys;
+    keys.reserve(paths.size());
+    for (auto& [key, entry] : paths) {
+        keys.push_back(key);
+    }
+    std::sort(keys.begin(), keys.end()); // a parent sorts before anything in it, so a directory's been dealt with by the time we get to its children
+    auto gone = [&](std::string key) { // record everything under key as removed, deepest first, then drop it
+        std::vector<std::string> visit { key };
+        std::vector<std::string> found;
+        while (visit.size() > 0) {
+            std::string k = visit.back();
+            visit.pop_back();
+            found.push_back(k);
+            IndexedPath* entry = find(k);
+            if (entry != NULL) {
+                for (std::string& child : entry -> children) {
+                    visit.push_back(k.size() == 0 ? child : k + '/' + child);
+                }
+            }
+        }
+        for (size_t i = found.size(); i > 0; i --) {
+            removed.push_back(absolute(found[i - 1]));
+        }
+        remove(absolute(key));
+    };
+    for (std::string& key : keys) {
+        auto it = paths.find(key);
+        if (it == paths.end()) { // went with its directory
+            continue;
+        }
+        IndexedPath& entry = it -> second;
+        std::string full = absolute(key);
+        struct stat sb;
+        if (lstat(full.c_str(), &sb) != 0) {
+            gone(key);
+            continue;
+        }
+        bool isDir = S_ISDIR(sb.st_mode);
+        if (isDir != (entry.type == FileMan::PathState::Directory)) { // a file became a directory or the other way around
+            gone(key);
+            scan(full, &files, &dirs);
+            continue;
+        }
+        bool moved = sb.st_size != entry.size || sb.st_mtim.tv_sec != entry.mtime.tv_sec || sb.st_mtim.tv_nsec != entry.mtime.tv_nsec;
+        if (!moved) {
+            continue;
+        }
+        insert(key, &sb);
+        if (!isDir) {
+            if (S_ISREG(sb.st_mode)) {
+                files.push_back(full);
+            }
+            continue;
+        }
+        // something was added to or taken out of this directory. Read it and compare against what we have.
+        DIR* d = opendir(full.c_str());
+        if (d == NULL) {
+            continue;
+        }
+        std::vector<std::string> names;
+        struct dirent* ent;
+        while ((ent = readdir(d)) != NULL) {
+            if (strcmp(ent -> d_name, ".") != 0 && strcmp(ent -> d_name, "..") != 0) {
+                names.push_back(ent -> d_name);
+            }
+        }
+        closedir(d);
+        std::sort(names.begin(), names.end());
+        std::vector<std::string> known = paths[key].children; // copied, because gone() and scan() change it
+        std::string prefix = key.size() == 0 ? "" : key + '/';
+        for (std::string& name : known) {
+            if (!std::binary_search(names.begin(), names.end(), name)) {
+                gone(prefix + name);
+            }
+        }
+        for (std::string& name : names) {
+            if (!std::binary_search(known.begin(), known.end(), name)) {
+                scan(absolute(prefix + name), &files, &dirs);
+            }
+        }
+    }
+}
+
+IndexedPath* FileIndex::find(std::string key) {
+    auto it = paths.find(key);
+    if (it == paths.end()) {
+        return NULL;
+    }
+    return &(it -> second);
+}
+
+bool FileIndex::checkPath(std::string key, FileMan::PathState& out) {
+    if (!ready || !normalize(key)) {
+        return false;
+    }
+    IndexedPath* entry = find(key);
+    if (entry == NULL) {
+        out = FileMan::PathState::CNEP; // everything inside the directory is indexed, so if it's not here it doesn't exist
+        return true;
+    }
+    if (entry -> type == FileMan::PathState::Other) { // probably a symlink; FileMan::checkPath follows those, so let it decide
+        return false;
+    }
+    out = entry -> type;
+    return true;
+}
+
+bool FileIndex::children(std::string key, std::vector<std::string>& out) {
+    if (!ready || !normalize(key)) {
+        return false;
+    }
+    IndexedPath* entry = find(key);
+    if (entry == NULL || entry -> type != FileMan::PathState::Directory) {
+        return false;
+    }
+    out = entry -> children;
+    return true;
+}
@@ -5,7 +5,12 @@
 #include <fcntl.h>
 #include <iostream>
 #include <sitixwriter.hpp>
+#include <tarwriter.hpp>
 #include <filesystem>
+#include <dirent.h>
+#include <algorithm>
+#include <unistd.h>
+#include <cstring>
 
 
 std::string fconcat(std::string one, std::string two) { // sanely glue two filenames together (useful for things like "output-dir" + "test.html")
@@ -37,6 +42,14 @@ bool isChildOf(std::string parent, std::string path) {
 
 FileMan::FileMan(std::string rdir) {
     dir = rdir;
+    if (TarWriter::isArchive(rdir)) { // not a directory at all: everything create()d or copy()d gets streamed into this archive
+        writer.archive = new TarWriter;
+        if (!writer.archive -> open(rdir)) {
+            printf(ERROR "%s Fatal.\n", writer.archive -> error.c_str());
+            valid = false;
+        }
+        return;
+    }
     struct stat sb;
     if (stat(rdir.c_str(), &sb) == 0) {
         if (!S_ISDIR(sb.st_mode)) { // if the "folder" exists but is a regular file
@@ -75,12 +88,28 @@ FileMan::PathState FileMan::checkPath(std::string path) {
     }
 }
 
-bool FileMan::empty(bool y = false) { // returns whether the directory was emptied
+std::vector<std::string> FileMan::listDirectory(std::string path) {
+    std::vector<std::string> ret;
+    DIR* directory = opendir(transmuted(path).c_str());
+    if (directory == NULL) {
+        return ret;
+    }
+    struct dirent* entry;
+    while ((entry = readdir(directory)) != NULL) {
+        ret.push_back(entry -> d_name);
+    }
+    closedir(directory);
+    std::sort(ret.begin(), ret.end());
+    return ret;
+}
+
+bool FileMan::confirm(bool y) {
     struct stat sb;
     std::string dotsitix = ".sitix";
     if (!y && stat(transmuted(dotsitix).c_str(), &sb) == -1) {
         printf(WARNING "The directory %s does not appear to be managed by Sitix. This may be because this is the first build."
-        "\n\tRemember that Sitix will delete all the contents of %s before rendering!"
+        "\n\tSitix will delete all the contents of %s before this first render! After that, it keeps a manifest of what it wrote, and later builds"
+        "\n\tonly replace or delete the outputs listed in it (anything else you put there is left alone). With --no-manifest, every build wipes it."
         "\n\tAre you sure you want to \033[1mfully delete\033[0m the contents of %s and render this Sitix project to it? Y/N: ", dir.c_str(), dir.c_str(), dir.c_str());
         std::string line;
         std::cin >> line;
@@ -88,42 +117,223 @@ bool FileMan::empty(bool y = false) { // returns whether the directory was empti
             return false;
         }
     }
+    return true;
+}
+
+bool FileMan::empty(bool y = false) { // returns whether the directory was emptied
+    if (!confirm(y)) {
+        return false;
+    }
     rmrf(dir.c_str()); // todo: process errors from these guys
     mkdir(dir.c_str(), 0);
     mode_t mask = umask(0);
     chmod(dir.c_str(), 0775);
     umask(mask);
-    const char* dotsitixcontent = "Project rendered by Sitix (by Tyler Clarke). Sitix is free and open source software protected by GPLv3. For more information on Sitix, see the website: https://swaous.asuscomm.com/sitix. "
-    "\n\nThis file is automatically added to mark a project directory; the directory this is in will be FULLY DELETED by the next Sitix build and files in it should not be manually edited.";
-    create(dotsitix).write(dotsitixcontent, strlen(dotsitixcontent));
+    markManaged();
     return true;
 }
 
-FileWriteOutput FileMan::create(std::string name) {
-    name = transmuted(name);
-    mkdirR(name);
+bool FileMan::update(bool y) {
+    writer.manifest.root = dir;
+    writer.manifest.enabled = true;
+    if (writer.manifest.load()) {
+        printf(INFO "Found a build manifest. Only outputs that changed will be written.\n");
+        markManaged();
+        return true;
+    }
+    return empty(y);
+}
+
+bool FileMan::stage(bool y) {
+    if (!confirm(y)) { // the whole directory gets swapped out, so this is exactly as destructive as empty()
+        return false;
+    }
+    live = dir;
+    while (live.size() > 1 && live.back() == '/') {
+        live.pop_back();
+    }
+    dir = live + ".sitix-staging";
+    rmrf(dir.c_str()); // left over from a build that died before swapping
+    if (mkdir(dir.c_str(), 0) != 0) {
+        printf(ERROR "Couldn't create the staging directory %s.\n", dir.c_str());
+        perror("\tmkdir");
+        return false;
+    }
     mode_t mask = umask(0);
-    int output = ::open(name.c_str(), O_WRONLY | O_CREAT | O_TRUNC, 0770); // rw for user and group
-    // todo: sane permission inheritance (ACL doohickey?)
+    chmod(dir.c_str(), 0775);
     umask(mask);
-    if (output == -1) {
-        printf(ERROR "Couldn't open output file %s. This file will not be rendered.\n", name.c_str());
+    writer.manifest.root = dir;
+    writer.manifest.base = live;
+    writer.manifest.enabled = true;
+    if (writer.manifest.load()) {
+        printf(INFO "Found a build manifest. Unchanged outputs will be linked from the live site instead of rewritten.\n");
     }
-    FileWriteOutput fOut(output);
-    return fOut;
+    markManaged();
+    return true;
+}
+
+bool FileMan::swap() {
+    std::string staged = dir;
+    std::string retired = live + ".sitix-old-" + std::to_string(getpid());
+    if (renameat2(AT_FDCWD, staged.c_str(), AT_FDCWD, live.c_str(), RENAME_EXCHANGE) == 0) {
+        if (rename(staged.c_str(), retired.c_str()) != 0) { // staged is the old generation now
+            printf(WARNING "Couldn't retire the old generation %s. It will be cleaned up next build.\n", staged.c_str());
+            perror("\trename");
+        }
+    }
+    else if (errno == EINVAL || errno == ENOSYS) { // the filesystem can't exchange. Two renames will do, but the site is briefly missing between them.
+        if (rename(live.c_str(), retired.c_str()) != 0 || rename(staged.c_str(), live.c_str()) != 0) {
+            printf(ERROR "Couldn't move %s into place. The new build is still in %s.\n", live.c_str(), staged.c_str());
+            perror("\trename");
+            return false;
+        }
+    }
+    else {
+        printf(ERROR "Couldn't swap %s into place. The new build is still in %s.\n", live.c_str(), staged.c_str());
+        perror("\trenameat2");
+        return false;
+    }
+    writer.forget(staged); // the cached directory fds still point at the right directories, but they're cached under the wrong names now
+    dir = live;
+    writer.manifest.root = live; // from here on (watch mode), outputs are published in place, one atomic rename at a time
+    writer.manifest.base = "";
+    live = "";
+    if (reclaimer.joinable()) {
+        reclaimer.join();
+    }
+    reclaimer = std::thread(&FileMan::reclaim, this);
+    return true;
+}
+
+void FileMan::reclaim() {
+    size_t slash = dir.rfind('/');
+    std::string parent = slash == std::string::npos ? "." : dir.substr(0, slash == 0 ? 1 : slash);
+    std::string prefix = (slash == std::string::npos ? dir : dir.substr(slash + 1)) + ".sitix-old-";
+    DIR* directory = opendir(parent.c_str());
+    if (directory == NULL) {
+        return;
+    }
+    std::vector<std::string> retired;
+    struct dirent* entry;
+    while ((entry = readdir(directory)) != NULL) {
+        if (strncmp(entry -> d_name, prefix.c_str(), prefix.size()) == 0) {
+            retired.push_back(parent + "/" + entry -> d_name);
+        }
+    }
+    closedir(directory);
+    for (std::string& path : retired) { // includes any that earlier builds didn't get around to finishing
+        rmrf(path.c_str());
+    }
+}
+
+bool FileMan::isArchive() {
+    return writer.archive != NULL;
+}
+
+bool FileMan::closeArchive() {
+    if (writer.archive == NULL) {
+        return true;
+    }
+    if (!writer.archive -> close()) {
+        printf(ERROR "%s The archive is incomplete.\n", writer.archive -> error.c_str());
+        return false;
+    }
+    return true;
+}
+
+FileMan::~FileMan() {
+    if (reclaimer.joinable()) {
+        reclaimer.join();
+    }
+}
+
+void FileMan::markManaged() {
+    std::string dotsitix = ".sitix";
+    const char* dotsitixcontent = writer.manifest.enabled ?
+        "Project rendered by Sitix (by Tyler Clarke). Sitix is free and open source software protected by GPLv3. For more information on Sitix, see the website: https://swaous.asuscomm.com/sitix. "
+        "\n\nThis file is automatically added to mark a project directory. The next Sitix build only replaces or deletes the outputs listed in .sitix-manifest, "
+        "so files Sitix rendered here shouldn't be manually edited, but files it didn't render are left alone. (A build with --no-manifest FULLY DELETES this directory and rewrites it.)"
+        : "Project rendered by Sitix (by Tyler Clarke). Sitix is free and open source software protected by GPLv3. For more information on Sitix, see the website: https://swaous.asuscomm.com/sitix. "
+        "\n\nThis file is automatically added to mark a project directory; the directory this is in will be FULLY DELETED by the next Sitix build (run with --no-manifest) and files in it should not be manually edited.";
+    create(dotsitix).write(dotsitixcontent, strlen(dotsitixcontent));
+}
+
+FileWriteOutput FileMan::create(std::string name) {
+    return FileWriteOutput(&writer, transmuted(name));
+}
+
+void FileMan::copy(std::string from, std::string name) {
+    writer.copy(from, transmuted(name));
+}
+
+bool FileMan::isPassthrough(std::string path) {
+    int file = ::open(path.c_str(), O_RDONLY | O_CLOEXEC);
+    if (file == -1) {
+        return false; // let the normal path complain about it
+    }
+    char header[3];
+    ssize_t got = pread(file, header, 3, 0);
+    ::close(file);
+    if (got <= 0) { // empty files get the usual zero-size warning
+        return false;
+    }
+    // same rules as MapView::cmp: a file shorter than the header only has to match as much as it has
+    return memcmp(header, "[!]", got) != 0 && memcmp(header, "[?]", got) != 0;
+}
+
+void FileMan::remove(std::string name) {
+    writer.remove(transmuted(name));
 }
 
 MapView FileMan::open(std::string name) {
-    if (!maps.contains(name) || maps.at(name).needsReload()) {
-        MapView m(name);
-        if (m.isValid()) {
-            maps.erase(name); // if it exists, erase it out
-            // this prevents stupid MapView pointer stuff inside the std::map
-            maps.insert_or_assign(name, m);
+    struct stat sb;
+    bool found = stat(name.c_str(), &sb) == 0; // (outside the lock, like the load below: only the bookkeeping is shared)
+    {
+        std::lock_guard<std::mutex> lock(cacheMutex);
+        auto cached = maps.find(name);
+        if (cached != maps.end()) {
+            CachedMap& entry = cached -> second;
+            if (found && sb.st_dev == entry.device && sb.st_ino == entry.inode && sb.st_size == entry.size
+                && sb.st_mtim.tv_sec == entry.mtime.tv_sec && sb.st_mtim.tv_nsec == entry.mtime.tv_nsec) {
+                lru.splice(lru.begin(), lru, entry.age); // bump it to the front
+                return entry.view;
+            }
+            drop(name); // stale, drop it and map the new one
+        }
+    }
+    MapView m(name, &sb, readThreshold, &arena); // a big or slow file only holds up whoever asked for it
+    if (m.isValid()) {
+        std::lock_guard<std::mutex> lock(cacheMutex);
+        auto cached = maps.find(name);
+        if (cached != maps.end()) { // someone else loaded it while we were. Every hit is checked against a fresh stat anyway, so whichever copy
+            // ends up cached is fine; keep theirs if it's the same file, so there's only one in memory
+            CachedMap& entry = cached -> second;
+            if (sb.st_dev == entry.device && sb.st_ino == entry.inode && sb.st_size == entry.size
+                && sb.st_mtim.tv_sec == entry.mtime.tv_sec && sb.st_mtim.tv_nsec == entry.mtime.tv_nsec) {
+                lru.splice(lru.begin(), lru, entry.age);
+                return entry.view;
+            }
+            drop(name);
         }
-        return m;
+        lru.push_front(name);
+        maps.insert_or_assign(name, CachedMap {
+            .view = m,
+            .device = sb.st_dev,
+            .inode = sb.st_ino,
+            .mtime = sb.st_mtim,
+            .size = sb.st_size,
+            .age = lru.begin()
+        });
+        cachedBytes += sb.st_size;
+        evict();
+    }
+    return m;
+}
+
+void FileMan::evict() {
+    while (lru.size() > 1 && (cachedBytes > cacheBytes || maps.size() > cacheFiles)) { // never evict the map we just inserted
+        drop(lru.back());
     }
-    return maps.at(name);
 }
 
 std::string FileMan::transmuted(std::string path) {
@@ -139,5 +349,16 @@ std::string FileMan::arcTransmuted(std::string path) {
 }
 
 void FileMan::uncache(std::string path) {
-    maps.erase(path);
+    std::lock_guard<std::mutex> lock(cacheMutex);
+    drop(path);
+}
+
+void FileMan::drop(std::string path) {
+    auto cached = maps.find(path);
+    if (cached == maps.end()) {
+        return;
+    }
+    cachedBytes -= cached -> second.size;
+    lru.erase(cached -> second.age);
+    maps.erase(cached);
 }
\ No newline at end of file
@@ -0,0 +1,174 @@
+// definitions for Fingerprinter
+
+#include <fingerprint.hpp>
+#include <hash.hpp>
+#include <fcntl.h>
+#include <unistd.h>
+#include <sys/stat.h>
+#include <cstdio>
+#include <cerrno>
+
+
+static bool hashFile(int fd, uint64_t& out) {
+    Hasher hash;
+    char buffer[64 * 1024];
+    while (true) {
+        ssize_t got = read(fd, buffer, sizeof(buffer));
+        if (got == -1) {
+            if (errno == EINTR) {
+                continue;
+            }
+            return false;
+        }
+        if (got == 0) {
+            break;
+        }
+        hash.update(buffer, got);
+    }
+    out = hash.digest();
+    return true;
+}
+
+static std::string jsonString(std::string thing) { // paths can have quotes and backslashes in them, and technically control characters too
+    std::string ret = "\"";
+    for (char c : thing) {
+        if (c == '"' || c == '\\') {
+            ret += '\\';
+            ret += c;
+        }
+        else if ((unsigned char)c < 0x20) {
+            char escape[8];
+            snprintf(escape, sizeof(escape), "\\u%04x", c);
+            ret += escape;
+        }
+        else {
+            ret += c;
+        }
+    }
+    ret += '"';
+    return ret;
+}
+
+
+Fingerprinter::Fingerprinter(FileMan* in) {
+    input = in;
+}
+
+bool Fingerprinter::wants(std::string key) {
+    if (!enabled) {
+        return false;
+    }
+    size_t dot = key.rfind('.');
+    size_t slash = key.rfind('/');
+    if (dot == std::string::npos || (slash != std::string::npos && dot < slash)) {
+        return false;
+    }
+    return extensions.contains(key.substr(dot + 1));
+}
+
+bool Fingerprinter::resolve(std::string key, std::string& name) {
+    std::string path = input -> transmuted(key);
+    name = key;
+    if (!wants(key)) {
+        return input -> checkPath(key) == FileMan::PathState::File;
+    }
+    int fd = open(path.c_str(), O_RDONLY | O_CLOEXEC);
+    if (fd == -1) {
+        return false;
+    }
+    struct stat sb;
+    if (fstat(fd, &sb) != 0 || !S_ISREG(sb.st_mode)) {
+        close(fd);
+        return false;
+    }
+    {
+        std::lock_guard<std::mutex> lock(m_mutex);
+        auto known = assets.find(key);
+        if (known != assets.end()) {
+            Fingerprint& entry = known -> second;
+            if (sb.st_dev == entry.device && sb.st_ino == entry.inode && sb.st_size == entry.size
+                && sb.st_mtim.tv_sec == entry.mtime.tv_sec && sb.st_mtim.tv_nsec == entry.mtime.tv_nsec) {
+                close(fd);
+                name = entry.name;
+                return true;
+            }
+        }
+    }
+    if (!input -> isPassthrough(path)) { // a Sitix page that happens to be called .css: it's rendered, not copied, so there's nothing stable to hash
+        close(fd);
+        return true;
+    }
+    posix_fadvise(fd, 0, 0, POSIX_FADV_SEQUENTIAL);
+    uint64_t hash;
+    bool ok = hashFile(fd, hash);
+    close(fd);
+    if (!ok) {
+        printf(ERROR "Couldn't read %s to fingerprint it.\n", path.c_str());
+        perror("\tread");
+        return false;
+    }
+    std::lock_guard<std::mutex> lock(m_mutex);
+    Fingerprint& entry = assets[key];
+    entry.hash = hash;
+    entry.name = fingerprinted(key, hash);
+    entry.device = sb.st_dev;
+    entry.inode = sb.st_ino;
+    entry.size = sb.st_size;
+    entry.mtime = sb.st_mtim;
+    name = entry.name;
+    return true;
+}
+
+std::string Fingerprinter::publish(std::string key, std::string name) {
+    std::lock_guard<std::mutex> lock(m_mutex);
+    Fingerprint& entry = assets[key];
+    std::string old = entry.published;
+    if (old != name) {
+        entry.published = name;
+        dirty = true;
+    }
+    return old == name ? "" : old;
+}
+
+std::string Fingerprinter::forget(std::string key) {
+    std::lock_guard<std::mutex> lock(m_mutex);
+    auto known = assets.find(key);
+    if (known == assets.end()) {
+        return "";
+    }
+    std::string published = known -> second.published;
+    assets.erase(known);
+    dirty = true;
+    return published;
+}
+
+std::string Fingerprinter::json() {
+    std::lock_guard<std::mutex> lock(m_mutex);
+    std::string ret = "{\n";
+    bool first = true;
+    for (auto& [key, entry] : assets) {
+        if (entry.published.size() == 0) { // hashed for a lookup, but never actually made it into the output
+            continue;
+        }
+        if (!first) {
+            ret += ",\n";
+        }
+        first = false;
+        ret += "    " + jsonString(key) + ": { \"path\": " + jsonString(entry.published) + ", \"etag\": " + jsonString("\"" + Hasher::hex(entry.hash) + "\"")
+            + ", \"size\": " + std::to_string(entry.size) + " }";
+    }
+    ret += "\n}\n";
+    dirty = false;
+    return ret;
+}
+
+std::string Fingerprinter::fingerprinted(std::string path, uint64_t hash) {
+    std::string tag = Hasher::hex(hash).substr(0, 8);
+    size_t dot = path.rfind('.');
+    size_t slash = path.rfind('/');
+    size_t base = slash == std::string::npos ? 0 : slash + 1;
+    if (dot == std::string::npos || dot <= base) { // no extension (or a dotfile), so the hash just goes on the end
+        return path + "." + tag;
+    }
+    return path.substr(0, dot) + "." + tag + path.substr(dot);
+}
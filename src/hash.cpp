@@ -0,0 +1,132 @@
+// definitions for Hasher (XXH64, after Yann Collet's reference implementation)
+
+#include <hash.hpp>
+#include <cstring>
+
+
+static const uint64_t P1 = 0x9E3779B185EBCA87ULL;
+static const uint64_t P2 = 0xC2B2AE3D27D4EB4FULL;
+static const uint64_t P3 = 0x165667B19E3779F9ULL;
+static const uint64_t P4 = 0x85EBCA77C2B2AE63ULL;
+static const uint64_t P5 = 0x27D4EB2F165667C5ULL;
+
+static inline uint64_t rotl(uint64_t x, int r) {
+    return (x << r) | (x >> (64 - r));
+}
+
+static inline uint64_t read64(const unsigned char* p) { // little-endian, which is what XXH64 is defined over (and what we're running on)
+    uint64_t ret;
+    memcpy(&ret, p, 8);
+    return ret;
+}
+
+static inline uint32_t read32(const unsigned char* p) {
+    uint32_t ret;
+    memcpy(&ret, p, 4);
+    return ret;
+}
+
+static inline uint64_t round(uint64_t acc, uint64_t input) {
+    acc += input * P2;
+    acc = rotl(acc, 31);
+    return acc * P1;
+}
+
+static inline uint64_t merge(uint64_t acc, uint64_t val) {
+    acc ^= round(0, val);
+    return acc * P1 + P4;
+}
+
+
+Hasher::Hasher(uint64_t s) {
+    seed = s;
+    acc[0] = seed + P1 + P2;
+    acc[1] = seed + P2;
+    acc[2] = seed;
+    acc[3] = seed - P1;
+}
+
+void Hasher::update(const void* data, size_t length) {
+    const unsigned char* p = (const unsigned char*)data;
+    total += length;
+    if (pendingSize + length < 32) {
+        memcpy(pending + pendingSize, p, length);
+        pendingSize += length;
+        return;
+    }
+    if (pendingSize > 0) { // finish off the stripe we were partway through
+        size_t fill = 32 - pendingSize;
+        memcpy(pending + pendingSize, p, fill);
+        for (int i = 0; i < 4; i ++) {
+            acc[i] = round(acc[i], read64(pending + i * 8));
+        }
+        p += fill;
+        length -= fill;
+        pendingSize = 0;
+    }
+    while (length >= 32) {
+        for (int i = 0; i < 4; i ++) {
+            acc[i] = round(acc[i], read64(p + i * 8));
+        }
+        p += 32;
+        length -= 32;
+    }
+    memcpy(pending, p, length);
+    pendingSize = length;
+}
+
+uint64_t Hasher::digest() {
+    uint64_t h;
+    if (total >= 32) {
+        h = rotl(acc[0], 1) + rotl(acc[1], 7) + rotl(acc[2], 12) + rotl(acc[3], 18);
+        for (int i = 0; i < 4; i ++) {
+            h = merge(h, acc[i]);
+        }
+    }
+    else {
+        h = seed + P5;
+    }
+    h += total;
+    const unsigned char* p = pending;
+    size_t left = pendingSize;
+    while (left >= 8) {
+        h ^= round(0, read64(p));
+        h = rotl(h, 27) * P1 + P4;
+        p += 8;
+        left -= 8;
+    }
+    if (left >= 4) {
+        h ^= (uint64_t)read32(p) * P1;
+        h = rotl(h, 23) * P2 + P3;
+        p += 4;
+        left -= 4;
+    }
+    while (left > 0) {
+        h ^= (*p) * P5;
+        h = rotl(h, 11) * P1;
+        p ++;
+        left --;
+    }
+    h ^= h >> 33;
+    h *= P2;
+    h ^= h >> 29;
+    h *= P3;
+    h ^= h >> 32;
+    return h;
+}
+
+uint64_t Hasher::of(const void* data, size_t length, uint64_t seed) {
+    Hasher h(seed);
+    h.update(data, length);
+    return h.digest();
+}
+
+std::string Hasher::hex(uint64_t hash) {
+    static const char* digits = "0123456789abcdef";
+    std::string ret(16, '0');
+    for (int i = 15; i >= 0; i --) {
+        ret[i] = digits[hash & 15];
+        hash >>= 4;
+    }
+    return ret;
+}
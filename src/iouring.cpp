@@ -0,0 +1,168 @@
+// definitions for IoUring
+
+#include <iouring.hpp>
+#include <sys/syscall.h>
+#include <sys/mman.h>
+#include <unistd.h>
+#include <cstring>
+#include <cstdlib>
+#include <cerrno>
+#include <defs.h>
+#include <stdio.h>
+
+
+bool IoUring::enabled = false;
+
+
+IoUring& IoUring::local() {
+    thread_local IoUring ring;
+    return ring;
+}
+
+
+bool IoUring::init(unsigned size) {
+    if (tried) {
+        return usable();
+    }
+    tried = true;
+    if (!enabled) {
+        return false;
+    }
+    struct io_uring_params params;
+    memset(&params, 0, sizeof(params));
+    int ring = syscall(__NR_io_uring_setup, size, &params);
+    if (ring == -1) { // ENOSYS on old kernels, EPERM when a sandbox or io_uring_disabled says no
+        return false;
+    }
+    fd = ring;
+    entries = params.sq_entries;
+    sqRingSize = params.sq_off.array + params.sq_entries * sizeof(unsigned);
+    cqRingSize = params.cq_off.cqes + params.cq_entries * sizeof(struct io_uring_cqe);
+    if (params.features & IORING_FEAT_SINGLE_MMAP) { // both rings live in one mapping
+        if (cqRingSize > sqRingSize) {
+            sqRingSize = cqRingSize;
+        }
+        cqRingSize = sqRingSize;
+    }
+    sqRing = mmap(0, sqRingSize, PROT_READ | PROT_WRITE, MAP_SHARED | MAP_POPULATE, fd, IORING_OFF_SQ_RING);
+    if (sqRing == MAP_FAILED) {
+        sqRing = NULL;
+        close(fd);
+        fd = -1;
+        return false;
+    }
+    if (params.features & IORING_FEAT_SINGLE_MMAP) {
+        cqRing = sqRing;
+    }
+    else {
+        cqRing = mmap(0, cqRingSize, PROT_READ | PROT_WRITE, MAP_SHARED | MAP_POPULATE, fd, IORING_OFF_CQ_RING);
+        if (cqRing == MAP_FAILED) {
+            cqRing = NULL;
+            munmap(sqRing, sqRingSize);
+            sqRing = NULL;
+            close(fd);
+            fd = -1;
+            return false;
+        }
+    }
+    sqesSize = params.sq_entries * sizeof(struct io_uring_sqe);
+    sqes = (struct io_uring_sqe*)mmap(0, sqesSize, PROT_READ | PROT_WRITE, MAP_SHARED | MAP_POPULATE, fd, IORING_OFF_SQES);
+    if (sqes == MAP_FAILED) {
+        if (cqRing != sqRing) {
+            munmap(cqRing, cqRingSize);
+        }
+        munmap(sqRing, sqRingSize);
+        sqRing = NULL;
+        cqRing = NULL;
+        close(fd);
+        fd = -1;
+        return false;
+    }
+    char* sq = (char*)sqRing;
+    char* cq = (char*)cqRing;
+    sqHead = (unsigned*)(sq + params.sq_off.head);
+    sqTail = (unsigned*)(sq + params.sq_off.tail);
+    sqMask = (unsigned*)(sq + params.sq_off.ring_mask);
+    sqArray = (unsigned*)(sq + params.sq_off.array);
+    cqHead = (unsigned*)(cq + params.cq_off.head);
+    cqTail = (unsigned*)(cq + params.cq_off.tail);
+    cqMask = (unsigned*)(cq + params.cq_off.ring_mask);
+    cqes = (struct io_uring_cqe*)(cq + params.cq_off.cqes);
+    return true;
+}
+
+bool IoUring::usable() {
+    return fd != -1;
+}
+
+bool IoUring::supports(std::vector<int> opcodes) {
+    if (!usable()) {
+        return false;
+    }
+    size_t probeSize = sizeof(struct io_uring_probe) + 256 * sizeof(struct io_uring_probe_op);
+    struct io_uring_probe* probe = (struct io_uring_probe*)calloc(1, probeSize);
+    bool ret = syscall(__NR_io_uring_register, fd, IORING_REGISTER_PROBE, probe, 256) == 0;
+    for (int op : opcodes) {
+        if (!ret) {
+            break;
+        }
+        ret = op <= probe -> last_op && (probe -> ops[op].flags & IO_URING_OP_SUPPORTED);
+    }
+    free(probe);
+    return ret;
+}
+
+void IoUring::batch(size_t count, std::function<void(struct io_uring_sqe*, size_t)> prep, std::vector<int>& results) {
+    results.assign(count, 0);
+    size_t next = 0;
+    while (next < count) {
+        unsigned tail = *sqTail; // we're the only producer, so no need for an atomic load here
+        unsigned queued = 0;
+        while (next < count && queued < entries) {
+            unsigned index = tail & *sqMask;
+            struct io_uring_sqe* sqe = &sqes[index];
+            memset(sqe, 0, sizeof(*sqe));
+            prep(sqe, next);
+            sqe -> user_data = next;
+            sqArray[index] = index;
+            tail ++;
+            next ++;
+            queued ++;
+        }
+        __atomic_store_n(sqTail, tail, __ATOMIC_RELEASE); // publish the sqes to the kernel
+        unsigned reaped = 0;
+        unsigned toSubmit = queued;
+        while (reaped < queued) {
+            int r = syscall(__NR_io_uring_enter, fd, toSubmit, queued - reaped, IORING_ENTER_GETEVENTS, NULL, 0);
+            if (r == -1 && errno != EINTR && errno != EAGAIN && errno != EBUSY) {
+                printf(ERROR "io_uring_enter failed!\n");
+                perror("\tio_uring_enter");
+                abort(); // the sqes are in the kernel's hands, there's no sane way to recover from this
+            }
+            if (r > 0) {
+                toSubmit -= r;
+            }
+            unsigned head = *cqHead;
+            unsigned cqTailNow = __atomic_load_n(cqTail, __ATOMIC_ACQUIRE);
+            while (head != cqTailNow) {
+                struct io_uring_cqe* cqe = &cqes[head & *cqMask];
+                results[cqe -> user_data] = cqe -> res;
+                head ++;
+                reaped ++;
+            }
+            __atomic_store_n(cqHead, head, __ATOMIC_RELEASE);
+        }
+    }
+}
+
+IoUring::~IoUring() {
+    if (fd == -1) {
+        return;
+    }
+    munmap(sqes, sqesSize);
+    if (cqRing != sqRing) {
+        munmap(cqRing, cqRingSize);
+    }
+    munmap(sqRing, sqRingSize);
+    close(fd);
+}
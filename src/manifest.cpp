@@ -0,0 +1,138 @@
+// definitions for Manifest
+
+#include <manifest.hpp>
+#include <hash.hpp>
+#include <cstdio>
+#include <cstring>
+#include <cerrno>
+#include <cstdlib>
+#include <unistd.h>
+#include <algorithm>
+
+
+std::string Manifest::key(std::string path) {
+    if (path.size() <= root.size() || path.compare(0, root.size(), root) != 0) {
+        return path;
+    }
+    size_t start = root.size();
+    while (start < path.size() && path[start] == '/') {
+        start ++;
+    }
+    return path.substr(start);
+}
+
+bool Manifest::load() {
+    std::string name = (base.size() > 0 ? base : root) + "/" + filename;
+    FILE* file = fopen(name.c_str(), "r");
+    if (file == NULL) {
+        return false;
+    }
+    char* line = NULL;
+    size_t capacity = 0;
+    ssize_t length;
+    bool ok = true;
+    while ((length = getline(&line, &capacity, file)) > 0) {
+        if (line[length - 1] == '\n') {
+            line[-- length] = 0;
+        }
+        if (length < 18 || line[16] != ' ') { // 16 hex digits, a space, and at least one character of path
+            ok = false;
+            break;
+        }
+        line[16] = 0;
+        char* end;
+        uint64_t hash = strtoull(line, &end, 16);
+        if (end != line + 16) {
+            ok = false;
+            break;
+        }
+        previous[line + 17] = hash;
+    }
+    free(line);
+    fclose(file);
+    if (!ok) {
+        printf(WARNING "The build manifest %s is corrupt. Ignoring it.\n", name.c_str());
+        previous.clear();
+    }
+    return ok;
+}
+
+bool Manifest::record(std::string path, uint64_t hash) {
+    std::string k = key(path);
+    std::lock_guard<std::mutex> lock(m_mutex);
+    current[k] = hash;
+    auto was = previous.find(k);
+    if (was != previous.end() && was -> second == hash) {
+        return true;
+    }
+    previous[k] = hash; // (assuming the caller goes on to write it) this is what's on disc now
+    changed.push_back(k);
+    return false;
+}
+
+void Manifest::forget(std::string path) {
+    std::string k = key(path);
+    std::lock_guard<std::mutex> lock(m_mutex);
+    current.erase(k);
+    previous.erase(k);
+}
+
+std::vector<std::string> Manifest::prune() {
+    std::vector<std::string> ret;
+    std::lock_guard<std::mutex> lock(m_mutex);
+    for (auto it = previous.begin(); it != previous.end();) {
+        if (current.contains(it -> first)) {
+            it ++;
+            continue;
+        }
+        std::string full = root + "/" + it -> first;
+        if (unlink(full.c_str()) != 0 && errno != ENOENT) {
+            printf(WARNING "Couldn't prune stale output %s.\n", full.c_str());
+            perror("\tunlink");
+            it ++;
+            continue;
+        }
+        ret.push_back(it -> first);
+        size_t slash = full.rfind('/');
+        while (slash != std::string::npos && slash > root.size()) { // take out directories this emptied. rmdir refuses non-empty ones, which is when we stop.
+            full.resize(slash);
+            if (rmdir(full.c_str()) != 0) {
+                break;
+            }
+            slash = full.rfind('/');
+        }
+        it = previous.erase(it);
+    }
+    std::sort(ret.begin(), ret.end());
+    return ret;
+}
+
+bool Manifest::save() {
+    std::string name = root + "/" + filename;
+    std::string temp = name + ".tmp";
+    FILE* file = fopen(temp.c_str(), "w");
+    if (file == NULL) {
+        printf(ERROR "Couldn't write the build manifest %s.\n", name.c_str());
+        perror("\tfopen");
+        return false;
+    }
+    {
+        std::lock_guard<std::mutex> lock(m_mutex);
+        std::vector<std::string> keys;
+        keys.reserve(current.size());
+        for (auto& entry : current) {
+            keys.push_back(entry.first);
+        }
+        std::sort(keys.begin(), keys.end()); // sorted, so it diffs nicely
+        for (std::string& k : keys) {
+            fprintf(file, "%s %s\n", Hasher::hex(current[k]).c_str(), k.c_str());
+        }
+    }
+    if (fclose(file) != 0 || rename(temp.c_str(), name.c_str()) != 0) {
+        printf(ERROR "Couldn't write the build manifest %s.\n", name.c_str());
+        perror("\trename");
+        unlink(temp.c_str());
+        return false;
+    }
+    return true;
+}
@@ -8,6 +8,7 @@
 #include <sys/mman.h>
 #include <unistd.h>
 #include <cstring>
+#include <cerrno>
 
 
 void MapView::init(int file, char* mm, size_t size) {
@@ -19,42 +20,107 @@ void MapView::init(int file, char* mm, size_t size) {
 }
 
 MapView::MapView(int file, char* mm, size_t size) {
-    rCount = new int(1);
+    rCount = new std::atomic<int>(1);
     init(file, mm, size);
 }
 
-MapView::MapView(std::string filename) {
-    rCount = new int(1);
+void ArenaSlab::release() {
+    if (users.fetch_sub(1) == 1) {
+        free(data);
+        delete this;
+    }
+}
+
+char* ReadArena::alloc(size_t size, ArenaSlab*& slab) {
+    std::lock_guard<std::mutex> lock(m_mutex);
+    if (current == NULL || current -> capacity - current -> used < size) {
+        if (current != NULL) {
+            current -> release(); // the arena is done with it; the files inside keep it alive as long as they need
+        }
+        current = new ArenaSlab;
+        current -> capacity = size > slabSize ? size : slabSize;
+        current -> data = (char*)malloc(current -> capacity);
+        current -> users = 1;
+    }
+    char* ret = current -> data + current -> used;
+    current -> used += size;
+    current -> users ++;
+    slab = current;
+    return ret;
+}
+
+ReadArena::~ReadArena() {
+    if (current != NULL) {
+        current -> release();
+    }
+}
+
+void MapView::load(int file, size_t size, ReadArena* arena) {
+    if (arena != NULL) {
+        char* buffer = arena -> alloc(size, slab);
+        size_t got = 0;
+        while (got < size) {
+            ssize_t r = pread(file, buffer + got, size - got, got);
+            if (r == -1 && errno == EINTR) {
+                continue;
+            }
+            if (r <= 0) {
+                printf(ERROR "Short read while loading a file!\n");
+                perror("\tread");
+                slab -> release();
+                slab = NULL;
+                return;
+            }
+            got += r;
+        }
+        init(-1, buffer, size);
+        return;
+    }
+    map = (char*)mmap(0, size, PROT_READ, MAP_SHARED, file, 0);
+    if (map == MAP_FAILED) {
+        map = NULL;
+        perror("\tmmap");
+        return;
+    }
+    madvise(map, size, MADV_SEQUENTIAL); // the parser walks files front to back, so ask for aggressive readahead
+    madvise(map, size, MADV_WILLNEED); // and start it now rather than at the first page fault
+    init(-1, map, size);
+}
+
+MapView::MapView(std::string filename, struct stat* sbOut, size_t readBelow, ReadArena* arena) {
+    rCount = new std::atomic<int>(1);
     map = NULL;
+    fd = -1; // we never hold on to the descriptor
     int file = open(filename.c_str(), O_RDONLY);
-    fd = file; // so when the destructor calls it gets closed properly
     if (file == -1) {
         printf(ERROR "Can't open %s for memory mapping!\n", filename.c_str());
         perror("\topen");
         return;
     }
     struct stat sb;
-    if (stat(filename.c_str(), &sb)) {
+    if (fstat(file, &sb)) {
         printf(ERROR "Can't load %s for memory mapping!\n", filename.c_str());
-        perror("\tstat");
+        perror("\tfstat");
+        close(file);
         return;
     }
+    if (sbOut != NULL) {
+        *sbOut = sb;
+    }
     if (sb.st_size == 0) {
         printf(WARNING "%s has zero size and will not be rendered.\n\tIf you absolutely need an empty file there, consider writing a script to `touch` it in after Sitix builds.\n", filename.c_str());
+        close(file);
         return;
     }
-    map = (char*)mmap(0, sb.st_size, PROT_READ, MAP_SHARED, file, 0);
-    if (map == MAP_FAILED) {
-        map = NULL;
-        printf(ERROR "Can't load %s for memory mapping!\n", filename.c_str());
-        perror("\tmmap");
-        return;
+    load(file, sb.st_size, (arena != NULL && (size_t)sb.st_size < readBelow) ? arena : NULL);
+    close(file); // a mapping holds its own reference to the file, and a read buffer doesn't need one at all
+    if (map == NULL) {
+        printf(ERROR "Can't load %s!\n", filename.c_str());
     }
-    init(file, map, sb.st_size);
 }
 
 MapView::MapView(int file) {
-    rCount = new int(1);
+    rCount = new std::atomic<int>(1);
     map = NULL;
     fd = file;
     struct stat sb;
@@ -77,15 +143,53 @@ MapView::MapView(int file) {
     init(file, map, sb.st_size);
 }
 
-MapView::MapView(const MapView& m) {
-    *this = m;
+void MapView::share(const MapView& m) { // become another reference to m's underlying map
+    map = m.map;
+    length = m.length;
+    start = m.start;
+    end = m.end;
+    rCount = m.rCount;
+    fd = m.fd;
+    slab = m.slab;
     (*rCount) ++;
 }
 
+void MapView::release() { // drop our reference, unmapping (or freeing) if it was the last one
+    if (rCount -> fetch_sub(1) == 1) { // atomic, because views get handed to the writer thread and die over there
+        delete rCount;
+        if (slab != NULL) {
+            slab -> release();
+        }
+        else if (map != NULL) {
+            munmap(map, length);
+        }
+        if (fd != -1) {
+            close(fd);
+        }
+    }
+}
+
+MapView::MapView(const MapView& m) {
+    share(m);
+}
+
+MapView& MapView::operator=(const MapView& m) {
+    if (this != &m) {
+        MapView keep(m); // in case m is only alive because of our reference
+        release();
+        share(keep);
+    }
+    return *this;
+}
+
 bool MapView::isValid() {
     return map != NULL;
 }
 
+bool MapView::isPrivate() {
+    return slab != NULL;
+}
+
 char MapView::operator[](int64_t n) {
     if (len() == 0) {
         return EOF;
@@ -128,16 +232,7 @@ bool MapView::operator==(MapView& other) {
 }
 
 MapView::~MapView() {
-    (*rCount) --;
-    if (*rCount == 0) {
-        free(rCount);
-        if (map != NULL) {
-            munmap(map, length);
-        }
-        if (fd != -1) {
-            close(fd);
-        }
-    }
+    release();
 }
 
 MapView MapView::slice(size_t from, size_t len) {
@@ -203,14 +298,4 @@ void MapView::trim() { // tosses whitespace towards the `start`.
 char MapView::popFront() {
     end --;
     return map[end];
-}
-
-bool MapView::needsReload() {
-    struct stat sb;
-    if (fstat(fd, &sb) == 0) {
-        return sb.st_size != len(); // if the size has changed, the map needs to reload!
-    }
-    else {
-        return true;
-    }
 }
\ No newline at end of file
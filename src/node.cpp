@@ -1,4 +1,22 @@
 #include <node.hpp>
+#include <arena.hpp>
+#include <new>
+
+
+void* Node::operator new(size_t size) {
+    RequestArena* arena = RequestArena::current();
+    if (arena != NULL) {
+        return arena -> alloc(size);
+    }
+    return ::operator new(size);
+}
+
+void Node::operator delete(void* ptr) {
+    if (ptr == NULL || RequestArena::holds(ptr)) { // the arena gets it all back at once
+        return;
+    }
+    ::operator delete(ptr);
+}
 
 
 void Node::pTree(int tabLevel) { // replacing debugPrint because it's much more usefulicious
@@ -0,0 +1,59 @@
+// definitions for ParseCache
+
+#include <parsecache.hpp>
+#include <types/Object.hpp>
+#include <arena.hpp>
+
+
+ParsedFile::~ParsedFile() {
+    delete tree;
+}
+
+
+Object* ParseCache::get(std::string path, FileFlags* flags, uint64_t generation, bool* watched) {
+    std::shared_ptr<const ParsedFile> entry;
+    {
+        std::lock_guard<std::mutex> lock(m_mutex);
+        auto cached = files.find(path);
+        if (cached == files.end()) {
+            return NULL;
+        }
+        entry = cached -> second;
+        struct stat sb;
+        if (verify && (stat(path.c_str(), &sb) != 0 || sb.st_dev != entry -> device || sb.st_ino != entry -> inode || sb.st_size != entry -> size
+            || sb.st_mtim.tv_sec != entry -> mtime.tv_sec || sb.st_mtim.tv_nsec != entry -> mtime.tv_nsec)) { // changed without the watcher telling us
+            files.erase(cached);
+            return NULL;
+        }
+    }
+    if (flags != NULL) {
+        *flags = entry -> flags;
+    }
+    if (watched != NULL) {
+        *watched = entry -> watched.exchange(generation) == generation;
+    }
+    return (Object*)entry -> tree -> clone();
+}
+
+void ParseCache::put(std::string path, Object* tree, FileFlags flags) {
+    struct stat sb;
+    if (stat(path.c_str(), &sb) != 0) {
+        return;
+    }
+    std::shared_ptr<ParsedFile> entry = std::make_shared<ParsedFile>();
+    RequestArena::suspend(); // (if a request's render is the first to parse path, the copy we keep can't be in its arena)
+    entry -> tree = (Object*)tree -> clone();
+    RequestArena::resume();
+    entry -> flags = flags;
+    entry -> device = sb.st_dev;
+    entry -> inode = sb.st_ino;
+    entry -> size = sb.st_size;
+    entry -> mtime = sb.st_mtim;
+    std::lock_guard<std::mutex> lock(m_mutex);
+    files[path] = entry; // (if someone else parsed it at the same time, theirs is as good as ours)
+}
+
+void ParseCache::invalidate(std::string path) {
+    std::lock_guard<std::mutex> lock(m_mutex);
+    files.erase(path);
+}
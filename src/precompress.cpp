@@ -0,0 +1,181 @@
+// definitions for Precompressor
+
+#include <precompress.hpp>
+#include <writebehind.hpp>
+#include <cstring>
+#ifdef SITIX_HAVE_ZLIB
+#include <zlib.h>
+#endif
+#ifdef SITIX_HAVE_BROTLI
+#include <brotli/encode.h>
+#endif
+#ifdef SITIX_HAVE_ZSTD
+#include <zstd.h>
+#endif
+
+
+const char* Precompressor::suffix(Format format) {
+    if (format == Gzip) {
+        return ".gz";
+    }
+    else if (format == Brotli) {
+        return ".br";
+    }
+    return ".zst";
+}
+
+bool Precompressor::parse(std::string name, Format& out) {
+    if (name == "gz" || name == "gzip") {
+        out = Gzip;
+    }
+    else if (name == "br" || name == "brotli") {
+        out = Brotli;
+    }
+    else if (name == "zst" || name == "zstd") {
+        out = Zstd;
+    }
+    else {
+        return false;
+    }
+    return true;
+}
+
+bool Precompressor::available(Format format) {
+    if (format == Gzip) {
+#ifdef SITIX_HAVE_ZLIB
+        return true;
+#endif
+    }
+    else if (format == Brotli) {
+#ifdef SITIX_HAVE_BROTLI
+        return true;
+#endif
+    }
+    else if (format == Zstd) {
+#ifdef SITIX_HAVE_ZSTD
+        return true;
+#endif
+    }
+    return false;
+}
+
+bool Precompressor::wants(std::string path) {
+    if (formats.size() == 0) {
+        return false;
+    }
+    size_t dot = path.rfind('.');
+    size_t slash = path.rfind('/');
+    if (dot == std::string::npos || (slash != std::string::npos && dot < slash)) {
+        return false;
+    }
+    return extensions.contains(path.substr(dot + 1));
+}
+
+bool Precompressor::compress(Format format, std::vector<OutputSegment>& data, std::string& out) {
+    // all three of these are the same loop: feed each segment through, draining the output buffer whenever it fills, then finish the stream
+    char buffer[64 * 1024];
+    if (format == Gzip) {
+#ifdef SITIX_HAVE_ZLIB
+        z_stream zs;
+        memset(&zs, 0, sizeof(zs));
+        if (deflateInit2(&zs, fast ? 6 : 9, Z_DEFLATED, 15 + 16, 9, Z_DEFAULT_STRATEGY) != Z_OK) {
+            return false;
+        }
+        for (size_t i = 0; i <= data.size(); i ++) {
+            bool last = i == data.size();
+            zs.next_in = last ? NULL : (Bytef*)data[i].data();
+            zs.avail_in = last ? 0 : data[i].size();
+            int ret;
+            do {
+                zs.next_out = (Bytef*)buffer;
+                zs.avail_out = sizeof(buffer);
+                ret = deflate(&zs, last ? Z_FINISH : Z_NO_FLUSH);
+                out.append(buffer, sizeof(buffer) - zs.avail_out);
+            } while (ret != Z_STREAM_ERROR && (zs.avail_out == 0 || (last && ret != Z_STREAM_END)));
+            if (ret == Z_STREAM_ERROR) {
+                deflateEnd(&zs);
+                return false;
+            }
+        }
+        deflateEnd(&zs);
+        return true;
+#endif
+    }
+    else if (format == Brotli) {
+#ifdef SITIX_HAVE_BROTLI
+        BrotliEncoderState* state = BrotliEncoderCreateInstance(NULL, NULL, NULL);
+        if (state == NULL) {
+            return false;
+        }
+        BrotliEncoderSetParameter(state, BROTLI_PARAM_QUALITY, fast ? 5 : BROTLI_MAX_QUALITY);
+        bool ok = true;
+        for (size_t i = 0; i <= data.size() && ok; i ++) {
+            bool last = i == data.size();
+            size_t availIn = last ? 0 : data[i].size();
+            const uint8_t* nextIn = last ? NULL : (const uint8_t*)data[i].data();
+            do {
+                size_t availOut = sizeof(buffer);
+                uint8_t* nextOut = (uint8_t*)buffer;
+                if (!BrotliEncoderCompressStream(state, last ? BROTLI_OPERATION_FINISH : BROTLI_OPERATION_PROCESS, &availIn, &nextIn, &availOut, &nextOut, NULL)) {
+                    ok = false;
+                    break;
+                }
+                out.append(buffer, sizeof(buffer) - availOut);
+            } while (availIn > 0 || BrotliEncoderHasMoreOutput(state) || (last && !BrotliEncoderIsFinished(state)));
+        }
+        BrotliEncoderDestroyInstance(state);
+        return ok;
+#endif
+    }
+    else if (format == Zstd) {
+#ifdef SITIX_HAVE_ZSTD
+        ZSTD_CCtx* ctx = ZSTD_createCCtx();
+        if (ctx == NULL) {
+            return false;
+        }
+        ZSTD_CCtx_setParameter(ctx, ZSTD_c_compressionLevel, fast ? 3 : 19);
+        bool ok = true;
+        for (size_t i = 0; i <= data.size() && ok; i ++) {
+            bool last = i == data.size();
+            ZSTD_inBuffer in { last ? NULL : data[i].data(), last ? 0 : data[i].size(), 0 };
+            size_t remaining;
+            do {
+                ZSTD_outBuffer output { buffer, sizeof(buffer), 0 };
+                remaining = ZSTD_compressStream2(ctx, &output, &in, last ? ZSTD_e_end : ZSTD_e_continue);
+                if (ZSTD_isError(remaining)) {
+                    ok = false;
+                    break;
+                }
+                out.append(buffer, output.pos);
+            } while (in.pos < in.size || (last && remaining > 0));
+        }
+        ZSTD_freeCCtx(ctx);
+        return ok;
+#endif
+    }
+    (void)buffer;
+    (void)data;
+    (void)out;
+    return false;
+}
+
+void Precompressor::submit(size_t size, std::function<void()> task) {
+    {
+        std::unique_lock<std::mutex> lock(m_mutex);
+        room.wait(lock, [&]{ return pending == 0 || pending + size <= maxPending; }); // same rule as WriteBehind::submit: something always gets through
+        pending += size;
+    }
+    pool.submit(task);
+}
+
+void Precompressor::done(size_t size) {
+    {
+        std::lock_guard<std::mutex> lock(m_mutex);
+        pending -= size;
+    }
+    room.notify_all();
+}
+
+void Precompressor::wait() {
+    pool.wait();
+}
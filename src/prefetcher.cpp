@@ -0,0 +1,96 @@
+// definitions for Prefetcher
+
+#include <prefetcher.hpp>
+#include <fcntl.h>
+#include <unistd.h>
+#include <algorithm>
+
+
+void Prefetcher::start(std::vector<std::string> files) {
+    if (window == 0 || files.size() == 0) {
+        return;
+    }
+    queue = files;
+    worker = std::thread(&Prefetcher::run, this);
+}
+
+void Prefetcher::advance(size_t to) {
+    if (window == 0) {
+        return;
+    }
+    {
+        std::lock_guard<std::mutex> lock(m_mutex);
+        cursor = to;
+    }
+    wake.notify_one();
+}
+
+void Prefetcher::run() {
+    IoUring& ring = IoUring::local();
+    bool batched = ring.init() && ring.supports({ IORING_OP_OPENAT, IORING_OP_FADVISE, IORING_OP_CLOSE });
+    while (true) {
+        std::vector<std::string> paths;
+        {
+            std::unique_lock<std::mutex> lock(m_mutex);
+            wake.wait(lock, [&]{ return stopping || (issued < queue.size() && issued < cursor + window); });
+            if (stopping) {
+                return;
+            }
+            if (issued < cursor) { // the renderer overtook us, no point warming files it's already done with
+                issued = cursor;
+                continue;
+            }
+            size_t end = batched ? std::min(queue.size(), cursor + window) : issued + 1; // with a ring, grab the whole window at once
+            paths.assign(queue.begin() + issued, queue.begin() + end);
+            issued = end;
+        }
+        if (batched) {
+            warm(ring, paths);
+            continue;
+        }
+        int file = open(paths[0].c_str(), O_RDONLY);
+        if (file == -1) {
+            continue; // not our problem; the renderer will print a proper error when it gets here
+        }
+        readahead(file, 0, maxBytes);
+        close(file);
+    }
+}
+
+void Prefetcher::warm(IoUring& ring, std::vector<std::string>& paths) { // same thing as the loop in run(), but three syscalls for the whole window
+    std::vector<int> fds;
+    ring.batch(paths.size(), [&](struct io_uring_sqe* sqe, size_t i) {
+        sqe -> opcode = IORING_OP_OPENAT;
+        sqe -> fd = AT_FDCWD;
+        sqe -> addr = (unsigned long)paths[i].c_str();
+        sqe -> open_flags = O_RDONLY | O_CLOEXEC;
+    }, fds);
+    std::vector<int> opened;
+    for (int fd : fds) {
+        if (fd >= 0) {
+            opened.push_back(fd);
+        }
+    }
+    std::vector<int> results;
+    ring.batch(opened.size(), [&](struct io_uring_sqe* sqe, size_t i) {
+        sqe -> opcode = IORING_OP_FADVISE;
+        sqe -> fd = opened[i];
+        sqe -> len = maxBytes;
+        sqe -> fadvise_advice = POSIX_FADV_WILLNEED;
+    }, results);
+    ring.batch(opened.size(), [&](struct io_uring_sqe* sqe, size_t i) {
+        sqe -> opcode = IORING_OP_CLOSE;
+        sqe -> fd = opened[i];
+    }, results);
+}
+
+Prefetcher::~Prefetcher() {
+    {
+        std::lock_guard<std::mutex> lock(m_mutex);
+        stopping = true;
+    }
+    wake.notify_one();
+    if (worker.joinable()) {
+        worker.join();
+    }
+}
@@ -25,19 +25,26 @@ static int sitix_lookup(lua_State* L) {
 }
 #endif
 
-Session::Session(std::string inDir, std::string outDir, bool isWatchdog) : input(inDir), output(outDir), watchdog{isWatchdog} {
-    #ifdef INLINE_MODE_LUAJIT
-    lua = lua_open();
-    luaL_openlibs(lua);
-    lua_createtable(lua, 0, 0); // "sitix" table
-    lua_createtable(lua, 0, 1); // sitix metatable
-    lua_pushcfunction(lua, sitix_lookup); // push the index function
-    lua_setfield(lua, -2, "__index"); // attach the index function to the metatable
-    lua_setmetatable(lua, -2); // set the metatable as the metatable of the sitix table
-    lua_setglobal(lua, "sitix"); // set the table to a global variable named sitix
-    #endif
+Session::Session(std::string inDir, std::string outDir, bool isWatchdog) : input(inDir), output(outDir), index(inDir), assets(&input), watchdog{isWatchdog} {
 }
 
+#ifdef INLINE_MODE_LUAJIT
+lua_State* Session::lua() {
+    static thread_local lua_State* state = NULL; // (never closed: render threads last as long as Sitix does)
+    if (state == NULL) {
+        state = lua_open();
+        luaL_openlibs(state);
+        lua_createtable(state, 0, 0); // "sitix" table
+        lua_createtable(state, 0, 1); // sitix metatable
+        lua_pushcfunction(state, sitix_lookup); // push the index function
+        lua_setfield(state, -2, "__index"); // attach the index function to the metatable
+        lua_setmetatable(state, -2); // set the metatable as the metatable of the sitix table
+        lua_setglobal(state, "sitix"); // set the table to a global variable named sitix
+    }
+    return state;
+}
+#endif
+
 Object* Session::configLookup(std::string name) {
     for (Object* o : config) {
         if (o -> name == name) {
@@ -48,9 +55,28 @@ Object* Session::configLookup(std::string name) {
 }
 
 FileMan::PathState Session::checkPath(std::string path) {
+    FileMan::PathState state;
+    if (index.checkPath(path, state)) {
+        return state;
+    }
     return input.checkPath(path);
 }
 
+std::vector<std::string> Session::listDirectory(std::string path) {
+    std::vector<std::string> entries;
+    if (!index.children(path, entries)) {
+        entries = input.listDirectory(path);
+    }
+    std::vector<std::string> ret;
+    ret.reserve(entries.size());
+    for (std::string& entry : entries) {
+        if (entry[0] != '.') { // . and .. (and dotfiles)
+            ret.push_back(entry);
+        }
+    }
+    return ret;
+}
+
 std::string Session::transmuted(std::string path) {
     return input.transmuted(path);
 }
@@ -81,4 +107,12 @@ void Session::lock() {
 
 void Session::unlock() {
     m_mutex.unlock();
-}
\ No newline at end of file
+}
+
+void Session::lockShared() {
+    m_mutex.lock_shared();
+}
+
+void Session::unlockShared() {
+    m_mutex.unlock_shared();
+}
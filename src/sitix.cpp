@@ -24,11 +24,14 @@
 #include <sys/types.h>
 #include <dirent.h>
 #include <string>
+#include <unordered_set>
+#include <algorithm>
 #include <fileflags.h>
 #include <mapview.hpp>
 #include <sitixwriter.hpp>
 #include <util.hpp>
 #include <session.hpp>
+#include <iouring.hpp>
 #include <sys/inotify.h>
 
 #include <types/Object.hpp>
@@ -43,6 +46,7 @@
 #include <fcntl.h>
 
 #include <evals/evals.hpp>
+#include <arena.hpp>
 #include <pthread.h>
 
 
@@ -147,6 +151,9 @@ int fillObject(MapView& map, Object* container, FileFlags* fileflags, Session* s
                     else if (tagTarget.cmp("markdown")) {
                         fileflags -> markdown = true;
                     }
+                    else if (tagTarget.cmp("dynamo")) {
+                        fileflags -> dynamo = true;
+                    }
                 }
                 else if (tagRequest.cmp("off")) {
                     if (tagTarget.cmp("minify")) {
@@ -155,6 +162,9 @@ int fillObject(MapView& map, Object* container, FileFlags* fileflags, Session* s
                     else if (tagTarget.cmp("markdown")) {
                         fileflags -> markdown = false;
                     }
+                    else if (tagTarget.cmp("dynamo")) {
+                        fileflags -> dynamo = false;
+                    }
                 }
             }
             else {
@@ -198,60 +208,220 @@ Object* string2object(MapView& string, FileFlags* flags, Session* sitix) {
 }
 
 
+Object* loadPage(std::string in, Session* sitix, FileFlags& fileflags) { // parse (or fetch from the parse cache) the page at in, named and with its
+    // filename object, ready to render. NULL if it can't be read. Its root is marked watched if it's been rendered since the last change.
+    Object* file = NULL;
+    bool watched = false;
+    bool resident = sitix -> watchdog || sitix -> usesDynamo; // a page is only rendered more than once in watch mode, or by the server, so those are
+    // the only times it's worth keeping around
+    if (resident) {
+        file = sitix -> parses.get(in, &fileflags, sitix -> watcher.generation, &watched);
+    }
+    if (file == NULL) {
+        MapView map = sitix -> open(in);
+        if (!map.isValid()) {
+            printf(ERROR "Invalid map.\n");
+            return NULL;
+        }
+        Stats::Time parseStart = Stats::now();
+        file = string2object(map, &fileflags, sitix);
+        if (sitix -> stats.enabled) {
+            sitix -> stats.parse.record(Stats::since(parseStart));
+        }
+        if (resident) {
+            sitix -> parses.put(in, file, fileflags);
+        }
+    }
+    file -> namingScheme = Object::NamingScheme::Named;
+    file -> name = transmuted(sitix -> input.dir, (std::string)"", (std::string)in);
+    file -> isFile = true;
+    file -> watched = watched;
+    Object* fNameObj = new Object(sitix);
+    fNameObj -> virile = false;
+    fNameObj -> namingScheme = Object::NamingScheme::Named;
+    fNameObj -> name = "filename";
+    TextBlob* fNameContent = new TextBlob(sitix);
+    fNameContent -> fileflags = fileflags;
+    fNameContent -> data = file -> name;
+    fNameObj -> addChild(fNameContent);
+    fNameObj -> fileflags = fileflags;
+    file -> addChild(fNameObj);
+    return file;
+}
+
+
+Object* requestObject(DynamoRequest& request, Session* sitix, FileFlags& fileflags) { // the request object a dynamo page renders with:
+    // request.method, request.path, request.query.<name> and request.headers.<lowercase name>. Everything in it came from whoever sent the request,
+    // so it's HTML-escaped on the way in.
+    auto text = [&](std::string name, std::string value) {
+        Object* obj = new Object(sitix);
+        obj -> namingScheme = Object::NamingScheme::Named;
+        obj -> name = name;
+        obj -> fileflags = fileflags;
+        TextBlob* content = new TextBlob(sitix);
+        content -> fileflags = fileflags;
+        content -> data = escapeHTML(value);
+        obj -> addChild(content);
+        return obj;
+    };
+    auto group = [&](std::string name) {
+        Object* obj = new Object(sitix);
+        obj -> namingScheme = Object::NamingScheme::Named;
+        obj -> name = name;
+        obj -> fileflags = fileflags;
+        return obj;
+    };
+    Object* ret = group("request");
+    ret -> virile = false;
+    ret -> addChild(text("method", request.method));
+    ret -> addChild(text("path", request.path));
+    Object* query = group("query");
+    std::unordered_set<std::string> seen;
+    for (auto& [name, value] : request.query) {
+        if (name.size() > 0 && name.find('.') == std::string::npos && seen.insert(name).second) { // (the first of a repeated name wins, and a name
+            // with a dot in it could never be looked up anyways)
+            query -> addChild(text(name, value));
+        }
+    }
+    ret -> addChild(query);
+    Object* headers = group("headers");
+    for (auto& [name, value] : request.headers) {
+        if (name.find('.') == std::string::npos) {
+            headers -> addChild(text(name, value));
+        }
+    }
+    ret -> addChild(headers);
+    return ret;
+}
+
+
+bool renderPage(std::string in, Session* sitix, DynamoRequest& request, WriteOutput& out, bool& dynamic) { // --serve: render the page at in into
+    // out (memory, or a response that's streaming) rather than the output. False if it's a template or can't be read. Runs on the render pool,
+    // alongside the server and the watch loop.
+    // If it's a dynamo page, it's rendered with request in scope and dynamic is set.
+    sitix -> lockShared(); // the watch loop holds the session exclusively while it's changing the index and the dependency graph
+    RequestArena::enter(); // everything from here until the tree's deleted only lives as long as this render
+    FileFlags fileflags;
+    Object* file = loadPage(in, sitix, fileflags);
+    if (file == NULL || !file -> watched) { // nothing's watched up front with --on-demand, so the page has to ask to be told when it changes
+        // (lookups take care of everything it depends on). Once per generation is enough: the watcher's lock is global.
+        sitix -> watcher.filewatch(in);
+    }
+    bool rendered = file != NULL && !file -> isTemplate;
+    dynamic = rendered && fileflags.dynamo;
+    if (rendered) {
+        if (dynamic) {
+            file -> addChild(requestObject(request, sitix, fileflags));
+        }
+        else { // (dynamo pages would say this on every request)
+            printf(DYNAMO "Rendering %s on demand.\n", in.c_str());
+        }
+        SitixWriter stream(out);
+        Stats::Time renderStart = Stats::now();
+        file -> render(&stream, file, true);
+        if (sitix -> stats.enabled) {
+            sitix -> stats.render.record(Stats::since(renderStart));
+        }
+    }
+    delete file;
+    RequestArena::leave();
+    sitix -> unlockShared();
+    return rendered;
+}
+
+
 int renderFile(std::string in, Session* sitix, bool tmp = false) { // if tmp, render to a temporary file rather than to the output dir and return the fd
     // returns 0 if tmp is false
     int tmpfd = 0;
     std::string out = sitix -> toOutput(in);
     FileFlags fileflags;
-    printf(INFO "Rendering %s to %s.\n", in.c_str(), out.c_str());
-    MapView map = sitix -> open(in);
-    if (map.isValid()) {
-        Object* file = string2object(map, &fileflags, sitix);
-        file -> namingScheme = Object::NamingScheme::Named;
-        file -> name = transmuted(sitix -> input.dir, (std::string)"", (std::string)in);
-        file -> isFile = true;
-        Object* fNameObj = new Object(sitix);
-        fNameObj -> virile = false;
-        fNameObj -> namingScheme = Object::NamingScheme::Named;
-        fNameObj -> name = "filename";
-        TextBlob* fNameContent = new TextBlob(sitix);
-        fNameContent -> fileflags = fileflags;
-        fNameContent -> data = file -> name;
-        fNameObj -> addChild(fNameContent);
-        fNameObj -> fileflags = fileflags;
-        file -> addChild(fNameObj);
-        if (file -> isTemplate) {
-            printf(INFO "%s is marked [?], will not be rendered.\n", in.c_str());
-            printf("\tIf this file should be rendered, replace [?] with [!] in the header.\n");
-        }
-        else {
-            if (tmp) {
-                tmpfd = creat("/tmp/", O_TMPFILE);
-                if (tmpfd == -1) {
-                    printf(ERROR "Can't render to temporary file.\n");
-                    perror("\tcreat");
-                }
+    if (!tmp && sitix -> input.isPassthrough(in)) { // not a Sitix file, so there's nothing to render. Let the kernel copy it.
+        printf(INFO "Copying %s to %s.\n", in.c_str(), out.c_str());
+        sitix -> output.copy(in, out);
+        std::string hashed;
+        if (sitix -> assets.wants(out) && sitix -> assets.resolve(out, hashed) && hashed != out) { // the plain name stays too, for anything that doesn't use [^assets.]
+            printf(INFO "Copying %s to %s.\n", in.c_str(), hashed.c_str());
+            sitix -> output.copy(in, hashed);
+            std::string stale = sitix -> assets.publish(out, hashed);
+            if (stale.size() > 0) { // the asset changed under watch mode, so the old fingerprint is dead
+                sitix -> output.remove(stale);
             }
-            FileWriteOutput fOut = tmp ? FileWriteOutput(tmpfd) : sitix -> create(out);
-            SitixWriter stream(fOut);
-            file -> render(&stream, file, true);
         }
-        delete file;
+        return 0;
+    }
+    printf(INFO "Rendering %s to %s.\n", in.c_str(), out.c_str());
+    Object* file = loadPage(in, sitix, fileflags);
+    if (file == NULL) {
+        return tmpfd;
+    }
+    if (file -> isTemplate) {
+        printf(INFO "%s is marked [?], will not be rendered.\n", in.c_str());
+        printf("\tIf this file should be rendered, replace [?] with [!] in the header.\n");
     }
     else {
-        printf(ERROR "Invalid map.\n");
+        if (tmp) {
+            tmpfd = creat("/tmp/", O_TMPFILE);
+            if (tmpfd == -1) {
+                printf(ERROR "Can't render to temporary file.\n");
+                perror("\tcreat");
+            }
+        }
+        FileWriteOutput fOut = tmp ? FileWriteOutput(tmpfd) : sitix -> create(out);
+        SitixWriter stream(fOut);
+        Stats::Time renderStart = Stats::now();
+        file -> render(&stream, file, true);
+        if (sitix -> stats.enabled) {
+            sitix -> stats.render.record(Stats::since(renderStart));
+        }
+    }
+    if (sitix -> usesDynamo && !tmp) { // a dynamo page's output is only what it looks like without a request; the server renders it properly
+        sitix -> dynamo.mark(out, fileflags.dynamo && !file -> isTemplate);
     }
+    delete file;
     return tmpfd;
 }
 
 
+size_t reportWrites(Session* sitix) { // wait for the writer thread to catch up, and complain about anything that went wrong on it.
+    // Returns how many things went wrong.
+    std::vector<std::string> errors = sitix -> output.writer.drain();
+    for (std::string& error : errors) {
+        printf(ERROR "%s\n", error.c_str());
+    }
+    if (sitix -> output.writer.manifest.enabled) { // keep the manifest in step with what's on disc, so a build killed in watch mode doesn't lose track
+        sitix -> output.writer.manifest.save();
+    }
+    return errors.size();
+}
+
+void writeAssetManifest(Session* sitix) { // the fingerprint mapping and ETags, for --fingerprint. Written through the output like any page,
+    // so it lands in the build manifest (and the archive, if there is one).
+    std::string json = sitix -> assets.json();
+    FileWriteOutput out = sitix -> create(sitix -> assets.manifestName);
+    out.write(json.c_str(), json.size());
+}
+
+void writeList(std::string filename, std::vector<std::string>& paths) { // one path per line, for --changed-list
+    FILE* file = fopen(filename.c_str(), "w");
+    if (file == NULL) {
+        printf(ERROR "Couldn't write %s.\n", filename.c_str());
+        perror("\tfopen");
+        return;
+    }
+    for (std::string& path : paths) {
+        fprintf(file, "%s\n", path.c_str());
+    }
+    fclose(file);
+}
+
+
 struct ConfigEntry {
     std::string name;
     std::string content;
 };
 
 int main(int argc, char** argv) {
-    printf("\033[1mSitix v2.1 by Tyler Clarke\033[0m\n");
+    printf("\033[1mSitix v" SITIX_VERSION " by Tyler Clarke\033[0m\n");
     std::string outputDir = "output";
     std::string siteDir = "";
     std::vector<ConfigEntry> config;
@@ -259,6 +429,32 @@ int main(int argc, char** argv) {
     bool hasSpecificSitedir = false;
     bool wasConf = false;
     bool watchdog = false;
+    long cacheMB = -1; // mmap cache budgets; -1 means leave FileMan's defaults alone
+    long cacheFiles = -1;
+    long readThreshold = -1;
+    long prefetch = -1;
+    long writeBufferMB = -1;
+    long copyThreads = -1;
+    long debounce = -1; // milliseconds of quiet before watch mode rebuilds
+    long renderThreads = -1;
+    const char* linkAssets = NULL;
+    bool manifest = true;
+    bool staged = false;
+    bool fingerprint = false;
+    const char* precompress = NULL;
+    const char* precompressExt = NULL;
+    long precompressMin = -1;
+    const char* changedList = NULL;
+    const char* fingerprintExt = NULL;
+    const char* latencyLog = NULL;
+    const char* record = NULL;
+    long serve = -1; // port
+    const char* bindAddress = NULL;
+    long flushKB = -1; // streamed dynamo pages
+    long flushMS = -1;
+    long serveThreads = -1; // event loops
+    bool onDemand = false;
+    const char* replay = NULL;
     for (int i = 1; i < argc; i ++) {
         if (strcmp(argv[i], "-o") == 0) {
             i ++;
@@ -278,6 +474,109 @@ int main(int argc, char** argv) {
         else if (strcmp(argv[i], "-w") == 0) {
             watchdog = true;
         }
+        else if (strcmp(argv[i], "--cache-mb") == 0) {
+            i ++;
+            cacheMB = atol(argv[i]);
+        }
+        else if (strcmp(argv[i], "--cache-files") == 0) {
+            i ++;
+            cacheFiles = atol(argv[i]);
+        }
+        else if (strcmp(argv[i], "--read-threshold") == 0) {
+            i ++;
+            readThreshold = atol(argv[i]);
+        }
+        else if (strcmp(argv[i], "--prefetch") == 0) {
+            i ++;
+            prefetch = atol(argv[i]);
+        }
+        else if (strcmp(argv[i], "--write-buffer-mb") == 0) {
+            i ++;
+            writeBufferMB = atol(argv[i]);
+        }
+        else if (strcmp(argv[i], "--copy-threads") == 0) {
+            i ++;
+            copyThreads = atol(argv[i]);
+        }
+        else if (strcmp(argv[i], "--precompress") == 0) {
+            i ++;
+            precompress = argv[i];
+        }
+        else if (strcmp(argv[i], "--precompress-ext") == 0) {
+            i ++;
+            precompressExt = argv[i];
+        }
+        else if (strcmp(argv[i], "--precompress-min") == 0) {
+            i ++;
+            precompressMin = atol(argv[i]);
+        }
+        else if (strcmp(argv[i], "--fingerprint") == 0) {
+            fingerprint = true;
+        }
+        else if (strcmp(argv[i], "--fingerprint-ext") == 0) {
+            i ++;
+            fingerprintExt = argv[i];
+        }
+        else if (strcmp(argv[i], "--render-threads") == 0) {
+            i ++;
+            renderThreads = atol(argv[i]);
+        }
+        else if (strcmp(argv[i], "--latency-log") == 0) {
+            i ++;
+            latencyLog = argv[i];
+        }
+        else if (strcmp(argv[i], "--serve") == 0) {
+            i ++;
+            serve = atol(argv[i]);
+        }
+        else if (strcmp(argv[i], "--on-demand") == 0) {
+            onDemand = true;
+        }
+        else if (strcmp(argv[i], "--flush-kb") == 0) {
+            i ++;
+            flushKB = atol(argv[i]);
+        }
+        else if (strcmp(argv[i], "--flush-ms") == 0) {
+            i ++;
+            flushMS = atol(argv[i]);
+        }
+        else if (strcmp(argv[i], "--serve-threads") == 0) {
+            i ++;
+            serveThreads = atol(argv[i]);
+        }
+        else if (strcmp(argv[i], "--bind") == 0) {
+            i ++;
+            bindAddress = argv[i];
+        }
+        else if (strcmp(argv[i], "--record") == 0) {
+            i ++;
+            record = argv[i];
+        }
+        else if (strcmp(argv[i], "--replay") == 0) {
+            i ++;
+            replay = argv[i];
+        }
+        else if (strcmp(argv[i], "--debounce") == 0) {
+            i ++;
+            debounce = atol(argv[i]);
+        }
+        else if (strcmp(argv[i], "--staged") == 0) {
+            staged = true;
+        }
+        else if (strcmp(argv[i], "--no-manifest") == 0) {
+            manifest = false;
+        }
+        else if (strcmp(argv[i], "--changed-list") == 0) {
+            i ++;
+            changedList = argv[i];
+        }
+        else if (strcmp(argv[i], "--io-uring") == 0) {
+            IoUring::enabled = true;
+        }
+        else if (strcmp(argv[i], "--link-assets") == 0) {
+            i ++;
+            linkAssets = argv[i];
+        }
         else if (!hasSpecificSitedir) {
             hasSpecificSitedir = true;
             siteDir = argv[i];
@@ -292,7 +591,135 @@ int main(int argc, char** argv) {
             printf(ERROR "Unexpected argument %s\n", argv[i]);
         }
     }
+    if (IoUring::enabled && !IoUring::local().init()) {
+        printf(WARNING "io_uring isn't available here (%s). Falling back to plain syscalls.\n", strerror(errno));
+        IoUring::enabled = false;
+    }
+    if (replay != NULL) { // a replay is watch mode, just with somebody else's events
+        watchdog = true;
+    }
+    if (onDemand) {
+        if (serve < 0) {
+            printf(ERROR "--on-demand renders pages as they're requested, so it needs --serve.\n");
+            exit(1);
+        }
+        if (staged || replay != NULL) {
+            printf(WARNING "--staged and --replay don't do anything with --on-demand, since nothing's written to the output.\n");
+            staged = false;
+            replay = NULL;
+        }
+        watchdog = true; // the cache is only any good if it finds out when things change
+    }
+    if (watchdog) { // the latency report happens on SIGUSR1 and on the way out, which means catching them before any thread exists to get them instead
+        Stats::block();
+    }
     Session session(siteDir, outputDir, watchdog);
+    if (watchdog) {
+        session.stats.listen();
+    }
+    if (cacheMB >= 0) {
+        session.input.cacheBytes = cacheMB * 1024 * 1024;
+    }
+    if (cacheFiles >= 0) {
+        session.input.cacheFiles = cacheFiles;
+    }
+    if (readThreshold >= 0) {
+        session.input.readThreshold = readThreshold;
+    }
+    if (prefetch >= 0) {
+        session.prefetcher.window = prefetch;
+    }
+    if (writeBufferMB >= 0) {
+        session.output.writer.maxInflight = writeBufferMB * 1024 * 1024;
+    }
+    if (copyThreads > 0) {
+        session.output.writer.copiers.size = copyThreads;
+    }
+    if (precompress != NULL) { // comma separated formats, like gz,br
+        for (std::string& name : split(precompress, ',')) {
+            Precompressor::Format format;
+            if (!Precompressor::parse(name, format)) {
+                printf(WARNING "Unknown precompression format %s (expected gz, br or zst).\n", name.c_str());
+            }
+            else if (!Precompressor::available(format)) {
+                printf(WARNING "This build of Sitix doesn't have the library for %s, so no %s files will be made.\n", name.c_str(), Precompressor::suffix(format));
+            }
+            else {
+                session.output.writer.precompress.formats.push_back(format);
+            }
+        }
+    }
+    if (precompressExt != NULL) { // comma separated extensions, without the dot
+        session.output.writer.precompress.extensions.clear();
+        for (std::string& ext : split(precompressExt, ',')) {
+            session.output.writer.precompress.extensions.insert(ext);
+        }
+    }
+    if (precompressMin >= 0) {
+        session.output.writer.precompress.minSize = precompressMin;
+    }
+    if (renderThreads > 0) {
+        session.renderers.size = renderThreads;
+        session.dynamo.pool.size = renderThreads;
+    }
+    if (debounce >= 0) {
+        session.watcher.quiet = debounce;
+    }
+    if (latencyLog != NULL) {
+        if (!watchdog) {
+            printf(WARNING "--latency-log only measures rebuilds, so it doesn't do anything without -w.\n");
+        }
+        session.stats.logName = latencyLog;
+    }
+    session.assets.enabled = fingerprint;
+    if (fingerprintExt != NULL) { // comma separated extensions, without the dot
+        session.assets.extensions.clear();
+        for (std::string& ext : split(fingerprintExt, ',')) {
+            session.assets.extensions.insert(ext);
+        }
+    }
+    if (watchdog || serve >= 0) {
+        session.output.writer.mappedSpans = false; // inputs get edited while we're running, so mapped ones have to be copied
+    }
+    if (watchdog) {
+        session.output.writer.precompress.fast = true; // rebuilds (and the Dynamo invalidations behind them) wait on drain(), which waits on these
+    }
+    if (serve >= 0) { // (before the build, so that it knows to tell the server about dynamo pages and keep their parses)
+        session.usesDynamo = true;
+        session.parses.verify = false; // dynamo pages come out of the parse cache on every request, and stat'ing them all each time is too slow
+    }
+    if (linkAssets != NULL) {
+        if (strcmp(linkAssets, "reflink") == 0) {
+            session.output.writer.linkMode = WriteBehind::LinkMode::Reflink;
+        }
+        else if (strcmp(linkAssets, "hardlink") == 0) {
+            session.output.writer.linkMode = WriteBehind::LinkMode::Hardlink;
+        }
+        else if (strcmp(linkAssets, "copy") != 0) {
+            printf(WARNING "Unknown --link-assets mode %s (expected copy, reflink or hardlink). Assets will be copied.\n", linkAssets);
+        }
+    }
+    Trace trace;
+    if (record != NULL && replay != NULL) {
+        printf(ERROR "--record and --replay can't be used together.\n");
+        exit(1);
+    }
+    if (record != NULL) {
+        if (!watchdog) {
+            printf(WARNING "--record only records watch mode, so it doesn't do anything without -w.\n");
+        }
+        else if (trace.record(record)) {
+            session.watcher.recording = &trace;
+        }
+    }
+    if (replay != NULL) {
+        if (!trace.replay(replay)) {
+            exit(1);
+        }
+        session.watcher.replaying = &trace;
+        printf(WARNING "Replaying %s will write the recorded changes into %s, so it should be a scratch copy of the site as it was when the trace started.\n",
+            replay, siteDir.c_str());
+    }
     for (ConfigEntry& conf : config) {
         Object* obj = new Object(&session);
         obj -> name = conf.name;
@@ -303,49 +730,228 @@ int main(int argc, char** argv) {
             obj -> addChild(text);
         }
     }
-    printf(INFO "Cleaning output directory\n");
-    if (!session.output.empty(y)) {
+    if (!onDemand) {
+        printf(INFO "Cleaning output directory\n");
+    }
+    bool ready;
+    if (onDemand) { // there's no output, just whatever the server has in memory
+        ready = true;
+    }
+    else if (session.output.isArchive()) { // nothing to clean, compare against, or swap: the archive is written fresh every time
+        if (watchdog) {
+            printf(ERROR "Watch mode can't write to an archive (there's no taking things back out of a tar stream). Use a directory.\n");
+            exit(1);
+        }
+        if (staged || changedList != NULL) {
+            printf(WARNING "--staged and --changed-list don't do anything when the output is an archive.\n");
+        }
+        ready = session.output.valid;
+    }
+    else if (staged) { // (always with a manifest: that's what lets unchanged files be linked instead of copied)
+        ready = session.output.stage(y);
+    }
+    else {
+        ready = manifest ? session.output.update(y) : session.output.empty(y);
+    }
+    if (!ready) {
         printf("Abort.\n");
         exit(1);
     }
-    printf(INFO "Output directory clean.\n");
-    printf(INFO "Rendering project '%s' to '%s'.\n", siteDir.c_str(), outputDir.c_str());
+    if (!onDemand) {
+        printf(INFO "Output directory clean.\n");
+        printf(INFO "Rendering project '%s' to '%s'.\n", siteDir.c_str(), outputDir.c_str());
+    }
 
-    char* paths[] = { (char*)siteDir.c_str(), NULL }; // for FTS
-    FTS* ftsp = fts_open(paths, FTS_PHYSICAL | FTS_NOCHDIR, NULL);
-    if (ftsp == NULL) {
-        printf(ERROR "Couldn't initiate directory traversal.\n");
-        perror("\tfts_open");
+    std::vector<std::string> files; // the initial walk indexes the whole input tree, and then we render from what it found
+    std::vector<std::string> dirs;
+    session.index.scan(siteDir, &files, &dirs);
+    session.index.ready = true;
+    for (std::string& dir : dirs) {
+        session.watcher.dirwatch(dir);
+    }
+    if (!onDemand) { // (on demand, a page is watched once it's been served; a million inotify watches for pages nobody reads would be a waste)
+        session.prefetcher.start(files);
+        for (size_t i = 0; i < files.size(); i ++) {
+            session.prefetcher.advance(i);
+            renderFile(files[i], &session);
+            session.watcher.filewatch(files[i]);
+        }
     }
-    FTSENT* ent;
-    while ((ent = fts_read(ftsp)) != NULL) {
-        if (ent -> fts_info == FTS_F) {
-            renderFile(ent -> fts_path, &session);
-            session.watcher.filewatch(ent -> fts_path);
+    if (session.assets.enabled) {
+        writeAssetManifest(&session);
+    }
+    size_t failures = reportWrites(&session);
+    if (!session.output.closeArchive()) {
+        failures ++;
+    }
+    Manifest& built = session.output.writer.manifest;
+    if (built.enabled) {
+        std::vector<std::string> pruned = built.prune();
+        if (pruned.size() > 0) {
+            built.save();
+        }
+        printf(INFO "%zu outputs written, %zu unchanged, %zu pruned.\n", built.changed.size(), built.current.size() - built.changed.size(), pruned.size());
+        if (changedList != NULL) {
+            writeList(changedList, built.changed);
+            writeList(std::string(changedList) + ".deleted", pruned);
+        }
+    }
+    else if (changedList != NULL) {
+        printf(WARNING "--changed-list needs the build manifest, so it's ignored with --no-manifest.\n");
+    }
+    if (staged && !session.output.isArchive()) {
+        if (failures > 0) {
+            printf(ERROR "%zu outputs couldn't be written, so the new build was not swapped in. It's in %s.\n", failures, session.output.dir.c_str());
         }
-        else if (ent -> fts_info == FTS_D) {
-            session.watcher.dirwatch(ent -> fts_path);
+        else if (session.output.swap()) {
+            printf(INFO "Swapped the new build into %s.\n", session.output.dir.c_str());
+        }
+    }
+    if (serve >= 0) {
+        if (session.output.isArchive()) {
+            printf(ERROR "Dynamo serves a directory, not an archive.\n");
+            exit(1);
+        }
+        session.dynamo.root = onDemand ? session.input.dir : session.output.dir;
+        session.dynamo.port = serve;
+        if (bindAddress != NULL) {
+            session.dynamo.address = bindAddress;
+        }
+        if (flushKB > 0) {
+            session.dynamo.flushBytes = flushKB * 1024;
+        }
+        if (flushMS >= 0) {
+            session.dynamo.flushMillis = flushMS;
+        }
+        if (serveThreads >= 0) {
+            session.dynamo.workerCount = serveThreads;
+        }
+        session.dynamo.onDemand = onDemand;
+        session.dynamo.renderer = [&session](std::string path, DynamoRequest& request, WriteOutput& out, bool& dynamic) {
+            return renderPage(session.index.absolute(path), &session, request, out, dynamic);
+        };
+        if (onDemand) {
+            session.dynamo.watch = [&session](std::string path) { // (runs on the server's event loop, which mustn't wait out a rebuild for the
+                // session lock. The watcher has its own, and index.absolute is just string pasting.)
+                session.watcher.filewatch(session.index.absolute(path));
+            };
+        }
+        if (!session.dynamo.start()) {
+            exit(1);
+        }
+        if (watchdog) { // the watch loop has the main thread
+            session.dynamo.worker = std::thread(&Dynamo::run, &session.dynamo);
         }
     }
-    fts_close(ftsp);
     if (watchdog) {
         printf("\033[1;33mInitial build complete!\033[0m\n");
         printf(WATCHDOG "Sitix will now idle (it will not consume CPU) until a change is made, and will then re-render the affected files.\n");
+        printf(WATCHDOG "Send SIGUSR1 (kill -USR1 %d) for a latency report.\n", getpid());
+        session.stats.enabled = true;
+        size_t changeSets = 0; // for the replay report
+        size_t renders = 0;
+        size_t removals = 0;
+        std::unordered_set<std::string> renderedFiles;
         while (true) {
-            session.watcher.waitForModifications(&session, [&](std::string name){
-                session.lock();
-                printf(WATCHDOG "%s was modified.\n", name.c_str());
-                renderFile(name, &session);
+            ChangeSet changes = session.watcher.waitForModifications(&session);
+            if (session.watcher.finished) {
+                break;
+            }
+            if (changes.modified.size() == 0 && changes.deleted.size() == 0) { // things happened, but they cancelled out
+                continue;
+            }
+            session.stats.coalesce.record(std::chrono::duration_cast<std::chrono::nanoseconds>(changes.settled - changes.firstEvent).count());
+            session.lock(); // one lock for the whole set, rather than one per file. Only while things are dropped: request renders have to wait for it.
+            for (std::string& name : changes.changed) {
+                session.parses.invalidate(name);
+            }
+            if (onDemand) { // nothing to rebuild: whatever's stale gets rendered again the next time somebody asks for it
+                for (std::string& name : changes.modified) {
+                    session.dynamo.invalidate(session.toOutput(name));
+                }
+                for (std::string& name : changes.deleted) {
+                    session.input.uncache(name);
+                    session.parses.invalidate(name);
+                    session.dynamo.invalidate(session.toOutput(name));
+                }
+                printf(WATCHDOG "Dropped %zu changed pages from the cache, and %zu deleted ones.\n", changes.modified.size(), changes.deleted.size());
                 session.unlock();
-            }, [&](std::string name){
-                session.lock();
+                continue;
+            }
+            for (std::string& name : changes.deleted) {
                 printf(WATCHDOG "%s was deleted\n", name.c_str());
-                remove(session.output.transmuted(session.input.arcTransmuted(name)).c_str());
+                session.output.remove(session.input.arcTransmuted(name));
                 session.input.uncache(name); // remove it from the cached mmaps
-                session.unlock();
-            });
+                session.parses.invalidate(name);
+                std::string hashed = session.assets.forget(session.input.arcTransmuted(name));
+                if (hashed.size() > 0) {
+                    session.output.remove(hashed);
+                }
+            }
+            session.unlock(); // the rebuild itself only reads the index, and nothing else changes it while we're in here, so request renders can
+            // carry on alongside it
+            std::unordered_set<std::string> direct(changes.changed.begin(), changes.changed.end());
+            for (size_t wave = 0; wave < changes.waves.size(); wave ++) { // each wave on the pool at once, but a wave doesn't start until the last one's done
+                size_t from = changes.waves[wave];
+                size_t to = wave + 1 < changes.waves.size() ? changes.waves[wave + 1] : changes.modified.size();
+                // the pool starts things in the order they're submitted, so put the pages someone's most likely looking at first: the ones they just
+                // saved, and after that the most recently edited
+                std::vector<std::pair<std::string, struct timespec>> order;
+                for (size_t i = from; i < to; i ++) {
+                    IndexedPath* indexed = session.index.find(session.index.relative(changes.modified[i]));
+                    order.push_back({ changes.modified[i], indexed == NULL ? timespec{0, 0} : indexed -> mtime });
+                }
+                std::stable_sort(order.begin(), order.end(), [&](auto& one, auto& two) {
+                    bool oneDirect = direct.contains(one.first);
+                    if (oneDirect != direct.contains(two.first)) {
+                        return oneDirect;
+                    }
+                    if (one.second.tv_sec != two.second.tv_sec) {
+                        return one.second.tv_sec > two.second.tv_sec;
+                    }
+                    return one.second.tv_nsec > two.second.tv_nsec;
+                });
+                for (auto& [name, mtime] : order) {
+                    session.renderers.submit([&session, name]{
+                        printf(WATCHDOG "%s was modified.\n", name.c_str());
+                        renderFile(name, &session);
+                    });
+                }
+                session.renderers.wait();
+            }
+            if (session.assets.dirty) {
+                writeAssetManifest(&session);
+            }
+            Stats::Time rendered = Stats::now();
+            reportWrites(&session);
+            session.stats.write.record(Stats::since(rendered));
+            session.stats.total.record(Stats::since(changes.firstEvent));
+            if (session.usesDynamo) { // (after the drain: anything Dynamo loads from now on is the new version)
+                for (std::string& name : changes.modified) {
+                    session.dynamo.invalidate(session.toOutput(name));
+                }
+                for (std::string& name : changes.deleted) {
+                    session.dynamo.invalidate(session.toOutput(name));
+                }
+                session.dynamo.invalidate(session.assets.manifestName);
+            }
+            printf(WATCHDOG "Rebuilt %zu files and removed %zu.\n", changes.modified.size(), changes.deleted.size());
+            changeSets ++;
+            renders += changes.modified.size();
+            removals += changes.deleted.size();
+            renderedFiles.insert(changes.modified.begin(), changes.modified.end());
         }
+        printf(WATCHDOG "Replayed %zu events as %zu change sets: %zu renders of %zu different files, and %zu removals.\n", trace.events, changeSets,
+            renders, renderedFiles.size(), removals);
+        session.stats.report();
+        session.stats.log("replay");
     }
     printf("\033[1;33mBuild complete!\033[0m\n");
+    if (session.dynamo.worker.joinable()) { // after a --replay, the server has been running on its own thread all along: keep serving
+        session.dynamo.worker.join();
+    }
+    else if (session.usesDynamo) {
+        session.dynamo.run();
+    }
     return 0;
 }
@@ -2,15 +2,23 @@
 #include <sitixwriter.hpp>
 #include <unistd.h>
 #include <util.hpp>
+#include <cerrno>
 
 
 FileWriteOutput::FileWriteOutput(int fd) {
     file = fd;
+    buffer.reserve(capacity);
+}
+
+FileWriteOutput::FileWriteOutput(WriteBehind* wb, std::string path) {
+    writer = wb;
+    target = writer -> open(path);
+    buffer.reserve(capacity);
 }
 
 void FileWriteOutput::write(const char* data, size_t length) {
     while (length > 0) {
-        size_t writeSize = BufferSize - bufferPos; // the space remaining
+        size_t writeSize = capacity - buffer.size(); // the space remaining
         if (writeSize > length) {
             writeSize = length;
         }
@@ -18,33 +26,87 @@ void FileWriteOutput::write(const char* data, size_t length) {
             flush();
         }
         else {
-            for (size_t i = 0; i < writeSize; i ++) {
-                buffer[bufferPos + i] = data[i];
-            }
-            bufferPos += writeSize;
+            buffer.append(data, writeSize);
             data += writeSize;
             length -= writeSize;
         }
     }
 }
 
+void FileWriteOutput::writeSpan(MapView data) {
+    if (writer == NULL || data.len() < MinSpan || (!writer -> mappedSpans && !data.isPrivate())) {
+        write(data.cbuf(), data.len());
+        return;
+    }
+    if (buffer.size() > 0) { // seal the buffer so the span lands after it
+        segments.push_back(OutputSegment { .bytes = std::move(buffer) });
+        buffer = std::string();
+        buffer.reserve(capacity);
+    }
+    segments.push_back(OutputSegment { .view = data });
+    if (segments.size() >= MaxSegments) {
+        flush();
+    }
+}
+
 void FileWriteOutput::flush() {
-    ::write(file, buffer, bufferPos);
-    bufferPos = 0;
+    if (writer != NULL) {
+        if (buffer.size() > 0) {
+            segments.push_back(OutputSegment { .bytes = std::move(buffer) }); // the writer takes the whole buffer, so we start a new (bigger) one
+            if (capacity < MaxBuffer) {
+                capacity *= 2;
+            }
+            buffer = std::string();
+            buffer.reserve(capacity);
+        }
+        writer -> write(target, std::move(segments));
+        segments.clear();
+        return;
+    }
+    const char* data = buffer.c_str();
+    size_t left = buffer.size();
+    while (left > 0) {
+        ssize_t r = ::write(file, data, left);
+        if (r == -1 && errno == EINTR) {
+            continue;
+        }
+        if (r == -1) {
+            printf(ERROR "Couldn't write output! The file will be incomplete.\n");
+            perror("\twrite");
+            break;
+        }
+        data += r;
+        left -= r;
+    }
+    buffer.clear();
 }
 
 FileWriteOutput::~FileWriteOutput() {
     if (!move) { // allow this file descriptor to be moved into another FileWriteOutput without being closed.
         flush();
-        ::close(file);
+        if (writer != NULL) {
+            writer -> close(target);
+        }
+        else {
+            ::close(file);
+        }
     }
 }
 
 FileWriteOutput::FileWriteOutput(FileWriteOutput& f) {
     file = f.file;
+    target = f.target;
+    writer = f.writer;
+    buffer = std::move(f.buffer);
+    segments = std::move(f.segments);
+    capacity = f.capacity;
     f.move = true;
 }
 
+void WriteOutput::writeSpan(MapView data) {
+    write(data.cbuf(), data.len());
+}
+
 void StringWriteOutput::write(const char* data, size_t length) {
     content += std::string(data, length);
 }
@@ -362,5 +424,29 @@ void SitixWriter::write(std::string data) {
 }
 
 void SitixWriter::write(MapView data) {
-    write(data.cbuf(), data.len());
+    if (flags.markdown || flags.minify) { // these transform everything, so there's nothing to pass through untouched
+        write(data.cbuf(), data.len());
+        return;
+    }
+    if (!flags.sitix) {
+        output.writeSpan(data);
+        return;
+    }
+    // unescaping only drops the backslashes, so everything between them can go out as untouched spans of the input
+    const char* buf = data.cbuf();
+    size_t length = data.len();
+    size_t chunk = 0;
+    size_t search = 0;
+    while (chunk < length) {
+        const char* slash = (const char*)memchr(buf + search, '\\', length - search);
+        size_t end = slash == NULL ? length : slash - buf;
+        if (end > chunk) {
+            output.writeSpan(data.slice(chunk, end - chunk));
+        }
+        chunk = end + 1; // the escaped byte is the first byte of the next span
+        search = end + 2; // and it can't start an escape itself
+        if (search > length) {
+            search = length;
+        }
+    }
 }
\ No newline at end of file
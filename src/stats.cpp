@@ -0,0 +1,140 @@
+// definitions for Histogram and Stats
+
+#include <stats.hpp>
+#include <cstdio>
+#include <ctime>
+#include <csignal>
+#include <pthread.h>
+#include <unistd.h>
+#include <thread>
+
+
+Histogram::Histogram(const char* n) {
+    name = n;
+}
+
+void Histogram::record(uint64_t nanos) {
+    buckets[bucketOf(nanos)].fetch_add(1, std::memory_order_relaxed);
+    count.fetch_add(1, std::memory_order_relaxed);
+    sum.fetch_add(nanos, std::memory_order_relaxed);
+    uint64_t highest = max.load(std::memory_order_relaxed);
+    while (nanos > highest && !max.compare_exchange_weak(highest, nanos, std::memory_order_relaxed));
+}
+
+uint64_t Histogram::percentile(double p) {
+    uint64_t seen = count.load(std::memory_order_relaxed); // renders might be recording while we read, so this is only as exact as it can be
+    if (seen == 0) {
+        return 0;
+    }
+    uint64_t wanted = (uint64_t)(seen * p / 100.0 + 0.5);
+    if (wanted == 0) {
+        wanted = 1;
+    }
+    uint64_t passed = 0;
+    for (size_t i = 0; i < bucketCount; i ++) {
+        passed += buckets[i].load(std::memory_order_relaxed);
+        if (passed >= wanted) {
+            uint64_t value = valueOf(i);
+            uint64_t highest = max.load(std::memory_order_relaxed);
+            return value > highest ? highest : value; // the middle of the last bucket can be past the biggest thing in it
+        }
+    }
+    return max.load(std::memory_order_relaxed);
+}
+
+size_t Histogram::bucketOf(uint64_t value) {
+    if (value < (1ull << subBits)) { // small values get a bucket each
+        return value;
+    }
+    int shift = 63 - __builtin_clzll(value) - (subBits - 1); // how many low bits don't fit in the bucket, which leaves subBits significant ones
+    return ((size_t)shift << (subBits - 1)) + (value >> shift);
+}
+
+uint64_t Histogram::valueOf(size_t bucket) {
+    if (bucket < (1ull << subBits)) {
+        return bucket;
+    }
+    int shift = (bucket >> (subBits - 1)) - 1;
+    uint64_t lowest = (uint64_t)(bucket - ((size_t)shift << (subBits - 1))) << shift;
+    return lowest + ((1ull << shift) >> 1);
+}
+
+
+Stats::Time Stats::now() {
+    return std::chrono::steady_clock::now();
+}
+
+uint64_t Stats::since(Time start) {
+    return std::chrono::duration_cast<std::chrono::nanoseconds>(now() - start).count();
+}
+
+static double ms(uint64_t nanos) {
+    return nanos / 1000000.0;
+}
+
+void Stats::report() {
+    Histogram* all[] = { &coalesce, &parse, &render, &write, &total };
+    printf(WATCHDOG "Latency so far, in milliseconds (%lu rebuilds):\n", total.count.load());
+    printf("\t%-10s %8s %10s %10s %10s %10s %10s\n", "", "count", "p50", "p90", "p99", "max", "mean");
+    for (Histogram* h : all) {
+        uint64_t n = h -> count.load();
+        printf("\t%-10s %8lu %10.3f %10.3f %10.3f %10.3f %10.3f\n", h -> name, n, ms(h -> percentile(50)), ms(h -> percentile(90)),
+            ms(h -> percentile(99)), ms(h -> max.load()), n == 0 ? 0.0 : ms(h -> sum.load()) / n);
+    }
+}
+
+void Stats::log(const char* reason) {
+    if (logName.size() == 0) {
+        return;
+    }
+    FILE* file = fopen(logName.c_str(), "a");
+    if (file == NULL) {
+        printf(ERROR "Couldn't append to the latency log %s.\n", logName.c_str());
+        perror("\tfopen");
+        return;
+    }
+    fprintf(file, "{\"time\": %ld, \"version\": \"%s\", \"reason\": \"%s\"", (long)time(NULL), SITIX_VERSION, reason);
+    Histogram* all[] = { &coalesce, &parse, &render, &write, &total };
+    for (Histogram* h : all) {
+        uint64_t n = h -> count.load();
+        fprintf(file, ", \"%s\": {\"count\": %lu, \"p50_ms\": %.3f, \"p90_ms\": %.3f, \"p99_ms\": %.3f, \"max_ms\": %.3f, \"mean_ms\": %.3f}", h -> name, n,
+            ms(h -> percentile(50)), ms(h -> percentile(90)), ms(h -> percentile(99)), ms(h -> max.load()), n == 0 ? 0.0 : ms(h -> sum.load()) / n);
+    }
+    fprintf(file, "}\n");
+    fclose(file);
+}
+
+static sigset_t watched() {
+    sigset_t set;
+    sigemptyset(&set);
+    sigaddset(&set, SIGUSR1);
+    sigaddset(&set, SIGINT);
+    sigaddset(&set, SIGTERM);
+    return set;
+}
+
+void Stats::block() {
+    sigset_t set = watched();
+    pthread_sigmask(SIG_BLOCK, &set, NULL);
+}
+
+void Stats::listen() { // signal handlers can't safely printf (or do much of anything), so the signals stay blocked everywhere and this thread waits for them
+    std::thread([this]{
+        sigset_t set = watched();
+        while (true) {
+            int sig;
+            if (sigwait(&set, &sig) != 0) {
+                continue;
+            }
+            report();
+            if (sig == SIGUSR1) {
+                log("SIGUSR1");
+                fflush(stdout);
+                continue;
+            }
+            log("exit");
+            fflush(stdout);
+            _exit(128 + sig); // whatever's mid-render doesn't matter: it was going to be killed by this signal anyways
+        }
+    }).detach();
+}
@@ -0,0 +1,291 @@
+// definitions for TarWriter
+
+#include <tarwriter.hpp>
+#include <fcntl.h>
+#include <unistd.h>
+#include <cerrno>
+#include <cstring>
+#include <cstdio>
+#include <cstdlib>
+
+
+static bool endsWith(std::string& thing, const char* end) {
+    size_t len = strlen(end);
+    return thing.size() > len && thing.compare(thing.size() - len, len, end) == 0;
+}
+
+static void octal(char* field, size_t width, unsigned long long value) { // tar numbers are zero-padded octal, NUL-terminated
+    snprintf(field, width, "%0*llo", (int)(width - 1), value);
+}
+
+
+bool TarWriter::isArchive(std::string path) {
+    while (path.size() > 0 && path.back() == '/') {
+        path.pop_back();
+    }
+    return endsWith(path, ".tar") || endsWith(path, ".tar.gz") || endsWith(path, ".tgz");
+}
+
+bool TarWriter::open(std::string path) {
+    root = path;
+    while (root.size() > 0 && root.back() == '/') {
+        root.pop_back();
+    }
+    gzip = endsWith(root, ".tar.gz") || endsWith(root, ".tgz");
+#ifdef SITIX_HAVE_ZLIB
+    if (gzip) {
+        memset(&zs, 0, sizeof(zs));
+        if (deflateInit2(&zs, Z_DEFAULT_COMPRESSION, Z_DEFLATED, 15 + 16, 8, Z_DEFAULT_STRATEGY) != Z_OK) { // 15 + 16: gzip framing, not zlib
+            error = "Couldn't initialize gzip compression.";
+            return false;
+        }
+    }
+#else
+    if (gzip) {
+        error = "This build of Sitix doesn't have zlib, so it can't write " + root + ". Use a plain .tar.";
+        return false;
+    }
+#endif
+    const char* epoch = getenv("SOURCE_DATE_EPOCH");
+    mtime = epoch != NULL ? (time_t)strtoll(epoch, NULL, 10) : time(NULL);
+    fd = ::open(root.c_str(), O_WRONLY | O_CREAT | O_TRUNC | O_CLOEXEC, 0644);
+    if (fd == -1) {
+        error = "Couldn't create " + root + " (" + strerror(errno) + ").";
+        return false;
+    }
+    buffer.reserve(bufferSize);
+    return true;
+}
+
+std::string TarWriter::name(std::string path) {
+    if (path.size() > root.size() && path.compare(0, root.size(), root) == 0) {
+        path = path.substr(root.size());
+    }
+    size_t start = 0;
+    while (start < path.size() && path[start] == '/') {
+        start ++;
+    }
+    return path.substr(start);
+}
+
+void TarWriter::parents(std::string name) {
+    size_t slash = name.find('/');
+    while (slash != std::string::npos) {
+        std::string dir = name.substr(0, slash);
+        if (!dirs.contains(dir)) {
+            dirs.insert(dir);
+            header(dir + "/", 0, '5', 0755);
+        }
+        slash = name.find('/', slash + 1);
+    }
+}
+
+void TarWriter::header(std::string name, off_t size, char type, int mode) {
+    char block[512];
+    memset(block, 0, 512);
+    // ustar can fit a path of up to 100 bytes in name, or up to 256 if it can split it at a slash into prefix (155) and name (100).
+    // Anything longer (or a file over 8GiB) gets a pax extended header in front of it, which every tar from the last twenty years understands.
+    size_t split = std::string::npos;
+    if (name.size() > 100) {
+        for (size_t i = name.size() > 101 ? name.size() - 101 : 0; i < name.size() && i <= 155; i ++) {
+            if (name[i] == '/' && name.size() - i - 1 <= 100 && name.size() - i - 1 > 0) {
+                split = i;
+                break;
+            }
+        }
+    }
+    bool bigFile = (unsigned long long)size > 077777777777ULL;
+    if ((name.size() > 100 && split == std::string::npos) || bigFile) {
+        std::string records;
+        auto record = [&](std::string key, std::string value) { // "<length> key=value\n", where length counts its own digits
+            size_t body = key.size() + value.size() + 3; // space, =, newline
+            size_t length = body + 1;
+            while (std::to_string(length).size() + body != length) {
+                length ++;
+            }
+            records += std::to_string(length) + " " + key + "=" + value + "\n";
+        };
+        if (name.size() > 100 && split == std::string::npos) {
+            record("path", name);
+        }
+        if (bigFile) {
+            record("size", std::to_string(size));
+        }
+        std::string paxName = "PaxHeaders/" + name.substr(0, 80);
+        header(paxName, records.size(), 'x', 0644);
+        emit(records.data(), records.size());
+        pad(records.size());
+        if (split == std::string::npos) {
+            name = name.substr(0, 100); // readers use the pax path; this is just something for the ones that don't
+        }
+        if (bigFile) {
+            size = 0;
+        }
+    }
+    if (split != std::string::npos) {
+        memcpy(block + 345, name.data(), split); // prefix
+        memcpy(block, name.data() + split + 1, name.size() - split - 1);
+    }
+    else {
+        memcpy(block, name.data(), name.size() > 100 ? 100 : name.size());
+    }
+    octal(block + 100, 8, mode);
+    octal(block + 108, 8, 0); // uid
+    octal(block + 116, 8, 0); // gid
+    octal(block + 124, 12, size);
+    octal(block + 136, 12, mtime);
+    block[156] = type;
+    memcpy(block + 257, "ustar", 6); // magic, with its NUL
+    memcpy(block + 263, "00", 2); // version
+    memset(block + 148, ' ', 8); // the checksum is computed with its own field full of spaces
+    unsigned int sum = 0;
+    for (int i = 0; i < 512; i ++) {
+        sum += (unsigned char)block[i];
+    }
+    snprintf(block + 148, 8, "%06o", sum); // six digits, NUL, and the space that's already there
+    emit(block, 512);
+}
+
+void TarWriter::pad(off_t size) {
+    static const char zeros[512] = {0};
+    if (size % 512 != 0) {
+        emit(zeros, 512 - size % 512);
+    }
+}
+
+void TarWriter::add(std::string path, std::vector<OutputSegment>& data) {
+    if (error.size() > 0) {
+        return;
+    }
+    std::string n = name(path);
+    parents(n);
+    off_t size = 0;
+    for (OutputSegment& segment : data) {
+        size += segment.size();
+    }
+    header(n, size, '0', 0770);
+    for (OutputSegment& segment : data) {
+        emit(segment.data(), segment.size());
+    }
+    pad(size);
+}
+
+void TarWriter::addFile(std::string path, int in, off_t size) {
+    if (error.size() > 0) {
+        return;
+    }
+    std::string n = name(path);
+    parents(n);
+    header(n, size, '0', 0770);
+    off_t left = size;
+    if (!gzip) { // nothing to do to the bytes on the way through, so let the kernel move them
+        flush();
+        while (left > 0) {
+            ssize_t r = copy_file_range(in, NULL, fd, NULL, left, 0);
+            if (r <= 0) {
+                break; // not supported between these two, probably; the read loop below picks up where this left off
+            }
+            left -= r;
+        }
+    }
+    char chunk[64 * 1024];
+    while (left > 0 && error.size() == 0) {
+        ssize_t r = ::read(in, chunk, left < (off_t)sizeof(chunk) ? left : sizeof(chunk));
+        if (r == -1 && errno == EINTR) {
+            continue;
+        }
+        if (r <= 0) {
+            // the header already promised size bytes, so the archive is broken now. Fill it out with zeros so at least the rest of it lines up.
+            error = "Couldn't read all of the input for " + n + ((r == 0) ? " (it shrank while we were copying it)." : " (" + std::string(strerror(errno)) + ").");
+            break;
+        }
+        emit(chunk, r);
+        left -= r;
+    }
+    static const char zeros[4096] = {0};
+    while (left > 0) {
+        size_t z = left < (off_t)sizeof(zeros) ? left : sizeof(zeros);
+        emit(zeros, z);
+        left -= z;
+    }
+    pad(size);
+}
+
+void TarWriter::emit(const void* data, size_t length) {
+    if (buffer.size() + length > bufferSize) {
+        flush();
+    }
+    if (length >= bufferSize) { // too big to be worth buffering
+        if (gzip) {
+            buffer.append((const char*)data, length);
+            flush();
+        }
+        else {
+            writeOut((const char*)data, length);
+        }
+        return;
+    }
+    buffer.append((const char*)data, length);
+}
+
+void TarWriter::flush(bool finish) {
+#ifdef SITIX_HAVE_ZLIB
+    if (gzip) {
+        char out[64 * 1024];
+        zs.next_in = (Bytef*)buffer.data();
+        zs.avail_in = buffer.size();
+        int ret;
+        do {
+            zs.next_out = (Bytef*)out;
+            zs.avail_out = sizeof(out);
+            ret = deflate(&zs, finish ? Z_FINISH : Z_NO_FLUSH);
+            writeOut(out, sizeof(out) - zs.avail_out);
+        } while (zs.avail_out == 0 || (finish && ret != Z_STREAM_END && ret != Z_STREAM_ERROR));
+        buffer.clear();
+        return;
+    }
+#endif
+    (void)finish;
+    writeOut(buffer.data(), buffer.size());
+    buffer.clear();
+}
+
+void TarWriter::writeOut(const char* data, size_t length) {
+    while (length > 0 && error.size() == 0) {
+        ssize_t r = ::write(fd, data, length);
+        if (r == -1 && errno == EINTR) {
+            continue;
+        }
+        if (r == -1) {
+            error = "Couldn't write to " + root + " (" + strerror(errno) + ").";
+            return;
+        }
+        data += r;
+        length -= r;
+    }
+}
+
+bool TarWriter::close() {
+    if (fd == -1) {
+        return error.size() == 0;
+    }
+    static const char zeros[1024] = {0};
+    emit(zeros, 1024); // two empty blocks mark the end of the archive
+    flush(true);
+#ifdef SITIX_HAVE_ZLIB
+    if (gzip) {
+        deflateEnd(&zs);
+    }
+#endif
+    if (::close(fd) != 0 && error.size() == 0) {
+        error = "Couldn't finish writing " + root + " (" + strerror(errno) + ").";
+    }
+    fd = -1;
+    return error.size() == 0;
+}
+
+TarWriter::~TarWriter() {
+    if (fd != -1) {
+        close();
+    }
+}
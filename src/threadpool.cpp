@@ -0,0 +1,63 @@
+// definitions for ThreadPool
+
+#include <threadpool.hpp>
+
+
+ThreadPool::ThreadPool(size_t threads) {
+    size = threads;
+    if (size == 0) {
+        size = std::thread::hardware_concurrency();
+    }
+    if (size == 0) { // hardware_concurrency is allowed to not know
+        size = 1;
+    }
+}
+
+void ThreadPool::submit(std::function<void()> task) {
+    {
+        std::lock_guard<std::mutex> lock(m_mutex);
+        while (workers.size() < size) {
+            workers.push_back(std::thread(&ThreadPool::run, this));
+        }
+        tasks.push_back(std::move(task));
+    }
+    wake.notify_one();
+}
+
+void ThreadPool::wait() {
+    std::unique_lock<std::mutex> lock(m_mutex);
+    idle.wait(lock, [&]{ return tasks.size() == 0 && active == 0; });
+}
+
+void ThreadPool::run() {
+    while (true) {
+        std::function<void()> task;
+        {
+            std::unique_lock<std::mutex> lock(m_mutex);
+            wake.wait(lock, [&]{ return stopping || tasks.size() > 0; });
+            if (tasks.size() == 0) {
+                return;
+            }
+            task = std::move(tasks.front());
+            tasks.pop_front();
+            active ++;
+        }
+        task();
+        {
+            std::lock_guard<std::mutex> lock(m_mutex);
+            active --;
+        }
+        idle.notify_all();
+    }
+}
+
+ThreadPool::~ThreadPool() {
+    {
+        std::lock_guard<std::mutex> lock(m_mutex);
+        stopping = true;
+    }
+    wake.notify_all();
+    for (std::thread& worker : workers) {
+        worker.join();
+    }
+}
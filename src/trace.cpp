@@ -0,0 +1,93 @@
+// definitions for Trace
+
+#include <trace.hpp>
+#include <cstring>
+
+
+static const char* header = "sitix-trace 1\n";
+
+bool Trace::record(std::string name) {
+    file = fopen(name.c_str(), "w");
+    if (file == NULL) {
+        printf(ERROR "Couldn't create the trace %s.\n", name.c_str());
+        perror("\tfopen");
+        return false;
+    }
+    fputs(header, file);
+    start = Stats::now();
+    return true;
+}
+
+bool Trace::replay(std::string name) {
+    file = fopen(name.c_str(), "r");
+    if (file == NULL) {
+        printf(ERROR "Couldn't open the trace %s.\n", name.c_str());
+        perror("\tfopen");
+        return false;
+    }
+    char line[32];
+    if (fgets(line, sizeof(line), file) == NULL || strcmp(line, header) != 0) {
+        printf(ERROR "%s isn't a Sitix trace (or it's from a different version).\n", name.c_str());
+        fclose(file);
+        file = NULL;
+        return false;
+    }
+    return true;
+}
+
+void Trace::write(TraceEvent& event) {
+    event.offset = Stats::since(start) / 1000;
+    fprintf(file, "%lu %x %d %zu %ld\n", event.offset, event.mask, event.viaDirectory ? 1 : 0, event.path.size(), event.hasContent ? (long)event.content.size() : -1l);
+    fwrite(event.path.data(), 1, event.path.size(), file);
+    if (event.hasContent) {
+        fwrite(event.content.data(), 1, event.content.size(), file);
+    }
+    fputc('\n', file);
+    fflush(file); // watch mode usually ends with ^C, so don't leave anything sitting in the buffer
+    events ++;
+}
+
+TraceEvent* Trace::peek() {
+    if (!hasUpcoming) {
+        hasUpcoming = read(upcoming);
+    }
+    return hasUpcoming ? &upcoming : NULL;
+}
+
+void Trace::pop() {
+    hasUpcoming = false;
+}
+
+bool Trace::read(TraceEvent& event) {
+    unsigned long offset;
+    unsigned int mask;
+    int viaDirectory;
+    size_t pathLength;
+    long contentLength;
+    if (fscanf(file, "%lu %x %d %zu %ld", &offset, &mask, &viaDirectory, &pathLength, &contentLength) != 5 || fgetc(file) != '\n') {
+        return false;
+    }
+    event.offset = offset;
+    event.mask = mask;
+    event.viaDirectory = viaDirectory != 0;
+    event.path.resize(pathLength);
+    if (fread(event.path.data(), 1, pathLength, file) != pathLength) {
+        return false;
+    }
+    event.hasContent = contentLength >= 0;
+    event.content.resize(event.hasContent ? contentLength : 0);
+    if (event.hasContent && fread(event.content.data(), 1, contentLength, file) != (size_t)contentLength) {
+        return false;
+    }
+    if (fgetc(file) != '\n') {
+        return false;
+    }
+    events ++;
+    return true;
+}
+
+Trace::~Trace() {
+    if (file != NULL) {
+        fclose(file);
+    }
+}
@@ -4,129 +4,441 @@
 #include <limits.h> // TODO: pathconf things
 #include <sys/stat.h>
 #include <session.hpp>
+#include <poll.h>
+#include <chrono>
+#include <set>
+#include <fcntl.h>
+#include <util.hpp>
 
 
 void WatchedPath::addDep(WatchedPath* dep) {
-    bool exists = false;
-    for (WatchedPath* file : dependants) {
-        if (file == dep) {
-            exists = true;
-            break;
-        }
-    } // if it's not already a dependency here
-    if (!exists) {
-        dependants.push_back(dep);
+    if (dependants.insert(dep).second) { // if it's not already a dependency here
+        dep -> dependencies.insert(this);
     }
 }
 
 void WatchedPath::rmDep(WatchedPath* dep) {
-    for (size_t i = 0; i < dependants.size(); i ++) {
-        if (dependants[i] == dep) {
-            dependants[i] = dependants[dependants.size() - 1]; // swap-remove
-            dependants.pop_back();
-        }
+    if (dependants.erase(dep) > 0) {
+        dep -> dependencies.erase(this);
     }
 }
 
-void WatchedPath::treeModify(std::function<void(std::string)> onModify) {
-    for (size_t i = 0; i < dependants.size(); i ++) {
-        onModify(dependants[i] -> path);
-        dependants[i] -> treeModify(onModify);
-    }
-}
 
 
 TreeWatcher::TreeWatcher() {
     inotifier = inotify_init();
 }
 
-WatchedPath* TreeWatcher::filewatch(std::string file) {
-    for (WatchedPath* f : files) {
-        if (f -> path == file) {
-            return f;
-        }
-    } // if it doesn't already exist, create it
-    WatchedPath* f = new WatchedPath {
-        .path = file,
-        .watcher = inotify_add_watch(inotifier, file.c_str(), IN_CLOSE_WRITE)
-    };
-    files.push_back(f);
-    return f;
+WatchedPath* TreeWatcher::find(std::string path) {
+    std::lock_guard<std::mutex> lock(m_mutex);
+    auto it = files.find(path);
+    if (it == files.end()) {
+        return NULL;
+    }
+    return it -> second;
 }
 
-WatchedPath* TreeWatcher::dirwatch(std::string path) { // clone of filewatch with different flags
-    // todo: make this not copy/pasted
-    for (WatchedPath* d : files) {
-        if (d -> path == path) {
-            return d;
-        }
+WatchedPath* TreeWatcher::watch(std::string path, uint32_t mask) {
+    std::lock_guard<std::mutex> lock(m_mutex);
+    auto [it, fresh] = files.try_emplace(path, (WatchedPath*)NULL);
+    if (!fresh) {
+        return it -> second;
     } // if it doesn't already exist, create it
-    WatchedPath* d = new WatchedPath {
+    WatchedPath* w = new WatchedPath {
         .path = path,
-        .watcher = inotify_add_watch(inotifier, path.c_str(), IN_CREATE | IN_DELETE | IN_MOVED_FROM | IN_MOVED_TO)
+        .watcher = replaying == NULL ? inotify_add_watch(inotifier, path.c_str(), mask) : -1, // (a replay's events don't come from inotify)
+        .mask = mask
     };
-    files.push_back(d);
-    return d;
+    it -> second = w;
+    if (w -> watcher != -1) {
+        watches[w -> watcher] = w;
+    }
+    return w;
+}
+
+WatchedPath* TreeWatcher::filewatch(std::string file) {
+    return watch(file, IN_CLOSE_WRITE);
+}
+
+WatchedPath* TreeWatcher::dirwatch(std::string path) {
+    return watch(path, IN_CREATE | IN_DELETE | IN_MOVED_FROM | IN_MOVED_TO);
+}
+
+void TreeWatcher::depend(WatchedPath* dependency, WatchedPath* dependant) {
+    std::lock_guard<std::mutex> lock(m_mutex);
+    dependency -> addDep(dependant);
+}
+
+void TreeWatcher::rewatch(WatchedPath* w) {
+    std::lock_guard<std::mutex> lock(m_mutex);
+    auto old = watches.find(w -> watcher);
+    if (old != watches.end() && old -> second == w) {
+        watches.erase(old);
+    }
+    w -> watcher = replaying == NULL ? inotify_add_watch(inotifier, w -> path.c_str(), w -> mask) : -1;
+    if (w -> watcher != -1) {
+        watches[w -> watcher] = w;
+    }
 }
 
 void TreeWatcher::unwatch(std::string path) {
-    for (size_t i = 0; i < files.size(); i ++) {
-        if (files[i] -> path == path) {
-            WatchedPath* f = files[i];
-            files[i] = files[files.size() - 1];
-            files.pop_back();
-            inotify_rm_watch(inotifier, f -> watcher);
-            delete f;
-            for (WatchedPath* alive : files) {
-                alive -> rmDep(f);
+    std::lock_guard<std::mutex> lock(m_mutex);
+    auto it = files.find(path);
+    if (it == files.end()) {
+        return;
+    }
+    WatchedPath* f = it -> second;
+    files.erase(it);
+    auto byWatch = watches.find(f -> watcher);
+    if (byWatch != watches.end() && byWatch -> second == f) { // hardlinks share a watch descriptor, so it might belong to someone else by now
+        watches.erase(byWatch);
+        inotify_rm_watch(inotifier, f -> watcher);
+    }
+    for (WatchedPath* dependency : f -> dependencies) {
+        dependency -> dependants.erase(f);
+    }
+    for (WatchedPath* dependant : f -> dependants) {
+        dependant -> dependencies.erase(f);
+    }
+    delete f;
+}
+
+void TreeWatcher::invalidate(std::vector<WatchedPath*>& roots, ChangeSet& changes) {
+    std::lock_guard<std::mutex> lock(m_mutex);
+    // first find everything affected, each path once no matter how many ways there are to reach it
+    std::vector<WatchedPath*> affected;
+    std::unordered_set<WatchedPath*> seen;
+    for (WatchedPath* root : roots) {
+        if (seen.insert(root).second) {
+            affected.push_back(root);
+        }
+    }
+    for (size_t i = 0; i < affected.size(); i ++) {
+        for (WatchedPath* dependant : affected[i] -> dependants) {
+            if (seen.insert(dependant).second) {
+                affected.push_back(dependant);
+            }
+        }
+    }
+    // then peel it off in waves (Kahn's algorithm): a path is ready once nothing it depends on is still waiting
+    std::unordered_map<WatchedPath*, size_t> waiting; // how many affected dependencies each affected path has left
+    for (WatchedPath* path : affected) {
+        for (WatchedPath* dependant : path -> dependants) {
+            if (dependant != path) { // a page that looks itself up doesn't have to wait for itself
+                waiting[dependant] ++;
             }
+        }
+    }
+    std::vector<WatchedPath*> wave;
+    for (WatchedPath* path : affected) {
+        if (waiting[path] == 0) {
+            wave.push_back(path);
+        }
+    }
+    size_t done = 0;
+    while (done < affected.size()) {
+        if (wave.size() == 0) { // everything left is waiting on something else that's left, so there's a cycle. Break it at the first path we found.
+            for (WatchedPath* path : affected) {
+                if (waiting[path] > 0) {
+                    printf(WARNING "%s is part of a dependency cycle, so it can't wait for everything it depends on.\n", path -> path.c_str());
+                    waiting[path] = 0;
+                    wave.push_back(path);
+                    break;
+                }
+            }
+        }
+        std::sort(wave.begin(), wave.end(), [](WatchedPath* one, WatchedPath* two) {
+            return one -> path < two -> path;
+        });
+        std::vector<WatchedPath*> next;
+        bool started = false;
+        for (WatchedPath* path : wave) {
+            done ++;
+            if (!(path -> mask & IN_CREATE)) { // (directories don't get rendered, only what depends on them)
+                if (!started) {
+                    changes.waves.push_back(changes.modified.size());
+                    started = true;
+                }
+                changes.modified.push_back(path -> path);
+            }
+            for (WatchedPath* dependant : path -> dependants) {
+                if (dependant != path && waiting[dependant] > 0 && -- waiting[dependant] == 0) {
+                    next.push_back(dependant);
+                }
+            }
+        }
+        wave = next;
+    }
+}
+
+struct PendingChange { // what's happened to one path so far in this window
+    bool created = false; // the first thing we saw was it appearing
+    bool deleted = false; // the last thing we saw was it going away
+};
+
+static bool slurp(std::string path, std::string& content) { // the whole file, for --record
+    int fd = open(path.c_str(), O_RDONLY | O_CLOEXEC);
+    if (fd == -1) {
+        return false;
+    }
+    content.clear();
+    char buffer[64 * 1024];
+    while (true) {
+        ssize_t got = read(fd, buffer, sizeof(buffer));
+        if (got == -1 && errno == EINTR) {
+            continue;
+        }
+        if (got <= 0) {
+            close(fd);
+            return got == 0;
+        }
+        content.append(buffer, got);
+    }
+}
+
+static void apply(TraceEvent& event, std::string absname) { // make the site directory look like it did when event was recorded (--replay)
+    if (event.mask & (IN_DELETE | IN_MOVED_FROM)) {
+        rmrf(absname.c_str());
+    }
+    else if (event.mask & IN_ISDIR) {
+        mkdirR(absname + "/");
+    }
+    else if (event.hasContent) {
+        mkdirR(absname);
+        int fd = open(absname.c_str(), O_WRONLY | O_CREAT | O_TRUNC | O_CLOEXEC, 0644);
+        if (fd == -1) {
+            printf(ERROR "Couldn't replay a write to %s.\n", absname.c_str());
+            perror("\topen");
             return;
         }
+        size_t done = 0;
+        while (done < event.content.size()) {
+            ssize_t wrote = write(fd, event.content.data() + done, event.content.size() - done);
+            if (wrote == -1) {
+                if (errno == EINTR) {
+                    continue;
+                }
+                printf(ERROR "Couldn't replay a write to %s.\n", absname.c_str());
+                perror("\twrite");
+                break;
+            }
+            done += wrote;
+        }
+        close(fd);
     }
 }
 
-void TreeWatcher::waitForModifications(Session* sitix, std::function<void(std::string)> onModify, std::function<void(std::string)> onDelete) {
-    char buffer[sizeof(struct inotify_event) + NAME_MAX + 1]; // the manual entry for inotify guarantees this to be a large enough buffer for a single inotify event
-    read(inotifier, buffer, sizeof(buffer));
-    struct inotify_event* evt = (struct inotify_event*)buffer;
-    std::string absname;
-    if (evt -> len > 0) { // it's a filename in a directory
-        for (WatchedPath* dir : files) {
-            if (dir -> watcher == evt -> wd) {
-                dir -> treeModify(onModify); // alert the modification tree for the parent directory of the updated file
-                absname = dir -> path + '/' + evt -> name;
+ChangeSet TreeWatcher::waitForModifications(Session* sitix) {
+    alignas(struct inotify_event) char buffer[64 * 1024]; // a single event is at most sizeof(inotify_event) + NAME_MAX + 1, so this takes a few hundred at once
+    std::vector<std::string> order; // paths in the order they first showed up
+    std::unordered_map<std::string, PendingChange> pending;
+    std::set<std::string> touchedDirs; // directories that gained or lost something; whatever listed them has to be re-rendered
+    bool overflowed = false;
+    auto note = [&](std::string path, bool deleted, bool created) {
+        auto [entry, fresh] = pending.try_emplace(path);
+        if (fresh) {
+            order.push_back(path);
+            entry -> second.created = created;
+        }
+        entry -> second.deleted = deleted;
+    };
+    auto trace = [&](std::string absname, uint32_t mask, bool viaDirectory, bool withContent) {
+        if (recording == NULL) {
+            return;
+        }
+        TraceEvent event;
+        event.mask = mask;
+        event.viaDirectory = viaDirectory;
+        event.path = absname.size() == 0 ? "" : sitix -> index.relative(absname);
+        event.hasContent = withContent && slurp(absname, event.content);
+        recording -> write(event);
+    };
+    auto handle = [&](std::string absname, uint32_t mask, bool viaDirectory) { // one event, from inotify or a trace
+        if (mask & IN_Q_OVERFLOW) { // the kernel dropped events. We don't know which, so once things settle we go and look.
+            trace("", mask, false, false);
+            overflowed = true;
+            return;
+        }
+        if (viaDirectory) { // it's a filename in a directory
+            touchedDirs.insert(absname.substr(0, absname.rfind('/')));
+        }
+        if (mask & (IN_CREATE | IN_MOVED_TO | IN_MODIFY | IN_CLOSE_WRITE)) {
+            bool created = mask & (IN_CREATE | IN_MOVED_TO);
+            struct stat sb;
+            if (lstat(absname.c_str(), &sb) != 0) { // already gone again; there's a deletion event for it further on
+                return;
+            }
+            if (S_ISDIR(sb.st_mode)) { // things can land in a new directory before we get a watch on it, so scan it rather than waiting for events
+                trace(absname, mask | IN_ISDIR, viaDirectory, false);
+                std::vector<std::string> newFiles;
+                std::vector<std::string> newDirs;
+                sitix -> index.scan(absname, &newFiles, &newDirs);
+                for (std::string& dir : newDirs) {
+                    trace(dir, IN_CREATE | IN_ISDIR, false, false); // (a replay doesn't have anything in the directory to scan, so it gets the scan's results)
+                    dirwatch(dir);
+                }
+                for (std::string& file : newFiles) {
+                    trace(file, IN_CREATE, false, true);
+                    filewatch(file);
+                    note(file, false, true);
+                }
+            }
+            else {
+                trace(absname, mask, viaDirectory, S_ISREG(sb.st_mode));
+                sitix -> index.refresh(absname); // keep the file index current before anything gets re-rendered against it
+                if (S_ISREG(sb.st_mode)) {
+                    WatchedPath* file = filewatch(absname);
+                    if (created) { // a file renamed over the old one is a different inode, and the old watch died with the old inode
+                        rewatch(file);
+                    }
+                    note(absname, false, created);
+                }
             }
         }
+        else if (mask & (IN_DELETE | IN_MOVED_FROM)) {
+            trace(absname, mask, viaDirectory, false);
+            unwatch(absname);
+            sitix -> index.remove(absname);
+            note(absname, true, false);
+        }
+        else {
+            printf(WARNING "Unrecognized inotify event %d on file %s\n", mask, absname.c_str());
+        }
+    };
+    auto start = std::chrono::steady_clock::now();
+    long coalesced = -1; // how long the window was held open, when that's not the same as how long we actually took (replays)
+    // (the session is locked while events are being handled, so that on-demand renders don't see the index or the dependency graph half-updated.
+    // It's not held while waiting.)
+    if (replaying != NULL) { // no waiting around: the recorded times say which events would have made it into the same window
+        sitix -> lock();
+        TraceEvent* event = replaying -> peek();
+        if (event == NULL) {
+            finished = true;
+        }
+        uint64_t first = event == NULL ? 0 : event -> offset;
+        uint64_t last = first;
+        while (event != NULL && event -> offset - last <= (uint64_t)quiet * 1000 && event -> offset - first < (uint64_t)maxDelay * 1000) {
+            last = event -> offset;
+            std::string absname = sitix -> index.absolute(event -> path);
+            apply(*event, absname);
+            handle(absname, event -> mask, event -> viaDirectory);
+            replaying -> pop();
+            event = replaying -> peek();
+        }
+        coalesced = std::min((last - first) / 1000 + quiet, (uint64_t)maxDelay);
+        sitix -> unlock();
     }
-    else { // it's a regular file
-        for (WatchedPath* file : files) {
-            if (file -> watcher == evt -> wd) {
-                absname = file -> path;
+    int timeout = -1; // the first wait is for as long as it takes
+    while (replaying == NULL) {
+        struct pollfd pfd = { inotifier, POLLIN, 0 };
+        int ready = poll(&pfd, 1, timeout);
+        if (ready == -1 && errno == EINTR) {
+            continue;
+        }
+        if (ready <= 0) { // it's been quiet for long enough
+            break;
+        }
+        ssize_t got = read(inotifier, buffer, sizeof(buffer));
+        if (got == -1) {
+            if (errno == EINTR) {
+                continue;
+            }
+            printf(ERROR "Couldn't read filesystem events.\n");
+            perror("\tread");
+            break;
+        }
+        if (timeout == -1) {
+            start = std::chrono::steady_clock::now();
+        }
+        sitix -> lock();
+        for (char* at = buffer; at < buffer + got; ) {
+            struct inotify_event* evt = (struct inotify_event*)at;
+            at += sizeof(struct inotify_event) + evt -> len;
+            if (evt -> mask & IN_IGNORED) { // a watch went away because its file did. The directory's event covers that.
+                continue;
+            }
+            if (evt -> mask & IN_Q_OVERFLOW) {
+                handle("", evt -> mask, false);
+                continue;
+            }
+            std::string absname;
+            {
+                std::lock_guard<std::mutex> lock(m_mutex); // (on-demand requests add watches without the session lock)
+                auto byWatch = watches.find(evt -> wd);
+                if (byWatch == watches.end()) { // an event that was already queued when we unwatched its path
+                    continue;
+                }
+                absname = byWatch -> second -> path;
             }
+            if (evt -> len > 0) {
+                absname += '/';
+                absname += evt -> name;
+            }
+            handle(absname, evt -> mask, evt -> len > 0);
+        }
+        sitix -> unlock();
+        long elapsed = std::chrono::duration_cast<std::chrono::milliseconds>(std::chrono::steady_clock::now() - start).count();
+        if (elapsed >= maxDelay) {
+            break;
         }
+        timeout = std::min((long)quiet, maxDelay - elapsed);
     }
-    if (evt -> mask & (IN_CREATE | IN_MOVED_TO | IN_MODIFY | IN_CLOSE_WRITE)) {
-        onModify(absname);
-        struct stat sb; // TODO: only stat on MOVED_TO and CREATE, so we don't waste all these cycles for modifying
-        stat(absname.c_str(), &sb);
-        if (S_ISDIR(sb.st_mode)) {
-            dirwatch(sitix -> toOutput(absname));
+    sitix -> lock();
+    if (overflowed) {
+        printf(WARNING "The kernel's event queue overflowed, so some changes weren't reported. Checking the site directory for them.\n");
+        std::vector<std::string> newFiles;
+        std::vector<std::string> newDirs;
+        std::vector<std::string> removed;
+        sitix -> index.resync(newFiles, newDirs, removed);
+        auto parentOf = [](std::string& path) {
+            return path.substr(0, path.rfind('/'));
+        };
+        for (std::string& path : removed) {
+            unwatch(path);
+            note(path, true, false);
+            touchedDirs.insert(parentOf(path));
         }
-        else if (S_ISREG(sb.st_mode)) {
-            filewatch(absname) -> treeModify(onModify);
+        for (std::string& dir : newDirs) {
+            dirwatch(dir);
+            touchedDirs.insert(parentOf(dir));
+        }
+        for (std::string& file : newFiles) {
+            rewatch(filewatch(file)); // it might be a different inode under the same name
+            note(file, false, false);
+            touchedDirs.insert(parentOf(file));
         }
     }
-    else if (evt -> mask & (IN_DELETE | IN_MOVED_FROM)) {
-        unwatch(absname);
-        onDelete(absname);
+    ChangeSet changes;
+    changes.settled = std::chrono::steady_clock::now();
+    changes.firstEvent = coalesced < 0 ? start : changes.settled - std::chrono::milliseconds(coalesced);
+    std::vector<WatchedPath*> roots;
+    for (std::string& path : order) {
+        PendingChange& change = pending[path];
+        if (change.deleted && !change.created) {
+            changes.deleted.push_back(path);
+        }
+        else if (!change.deleted) {
+            changes.changed.push_back(path);
+            WatchedPath* file = find(path);
+            if (file != NULL) {
+                roots.push_back(file);
+            }
+        }
     }
-    else {
-        printf(WARNING "Unrecognized inotify event %d on file %s\n", evt -> mask, absname.c_str());
+    for (const std::string& path : touchedDirs) {
+        WatchedPath* dir = find(path);
+        if (dir != NULL) {
+            roots.push_back(dir); // alert the modification tree for the parent directory of the updated file
+        }
     }
+    invalidate(roots, changes);
+    generation ++; // (even for an empty window: a resync might have changed what a lookup finds)
+    sitix -> unlock();
+    return changes;
 }
 
 TreeWatcher::~TreeWatcher() {
-    for (WatchedPath* file : files) {
+    for (auto& [path, file] : files) {
         inotify_rm_watch(inotifier, file -> watcher);
         delete file;
     }
@@ -21,4 +21,10 @@ void Copier::render(SitixWriter* out, Object* scope, bool dereference) {
     t -> setGhost(o);
 }
 
-Copier::Copier(Session* session) : Node(session){}
\ No newline at end of file
+Copier::Copier(Session* session) : Node(session){}
+
+Node* Copier::clone() {
+    Copier* ret = new Copier(*this);
+    ret -> parent = NULL;
+    return ret;
+}
@@ -16,4 +16,10 @@ DebuggerStatement::DebuggerStatement(Session* session) : Node(session) {}
 void DebuggerStatement::pTree(int tabLevel) {
     for (int i = 0; i < tabLevel; i ++) {printf("\t");}
     printf("CALL TO DEBUGGER\n");
-}
\ No newline at end of file
+}
+
+Node* DebuggerStatement::clone() {
+    DebuggerStatement* ret = new DebuggerStatement(*this);
+    ret -> parent = NULL;
+    return ret;
+}
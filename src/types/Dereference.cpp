@@ -27,4 +27,10 @@ void Dereference::render(SitixWriter* out, Object* scope, bool dereference) {
     found -> render(out, parent, true);
 }
 
-Dereference::Dereference(Session* session) : Node(session) {}
\ No newline at end of file
+Dereference::Dereference(Session* session) : Node(session) {}
+
+Node* Dereference::clone() {
+    Dereference* ret = new Dereference(*this);
+    ret -> parent = NULL;
+    return ret;
+}
@@ -50,4 +50,11 @@ void ForLoop::pTree(int tabLevel) { // replacing debugPrint because it's much mo
     for (int x = 0; x < tabLevel; x ++) {printf("\t");}
     printf("For loop over %s with iterator named %s\n", goal.c_str(), iteratorName.c_str());
     internalObject -> pTree(tabLevel + 1);
-}
\ No newline at end of file
+}
+
+Node* ForLoop::clone() {
+    ForLoop* ret = new ForLoop(*this);
+    ret -> parent = NULL;
+    ret -> internalObject = (Object*)internalObject -> clone();
+    return ret;
+}
@@ -38,4 +38,14 @@ void IfStatement::render(SitixWriter* out, Object* scope, bool dereference) {
         elseObject -> render(out, scope, true);
     }
     free(cond);
-}
\ No newline at end of file
+}
+
+Node* IfStatement::clone() {
+    IfStatement* ret = new IfStatement(*this);
+    ret -> parent = NULL;
+    ret -> mainObject = (Object*)mainObject -> clone();
+    if (elseObject != NULL) {
+        ret -> elseObject = (Object*)elseObject -> clone();
+    }
+    return ret;
+}
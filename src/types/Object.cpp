@@ -1,7 +1,6 @@
 #include <types/Object.hpp>
 #include <defs.h>
 #include <util.hpp>
-#include <dirent.h>
 #include <types/TextBlob.hpp>
 #include <types/PlainText.hpp>
 #include <session.hpp>
@@ -121,20 +120,40 @@ Object* Object::lookup(std::string& lname, Object* nope) { // lookup an object b
         // config searches, directory unpacks and file unpacks are on the root scope, see
         // check config
         Object* confCheck = sitix -> configLookup(lname);
-        if (confCheck != NULL) {
-            return confCheck;
+        if (confCheck != NULL) { // the page gets its own copy, since a replace on it would ghost it (and other pages are rendering alongside us)
+            for (Node* node : children) {
+                if (node -> type == Node::Type::OBJECT && ((Object*)node) -> namingScheme == Object::NamingScheme::Named && ((Object*)node) -> name == lname) {
+                    return (Object*)node; // (we already copied it. The children loop above only catches names without dots in them.)
+                }
+            }
+            Object* copy = (Object*)confCheck -> clone();
+            copy -> virile = false;
+            addChild(copy); // we're the root scope, so we own it, same as loaded files
+            return copy;
+        }
+        if (root == "assets" && rootSegLen < lname.size()) { // [^assets.css/site\.css] is the fingerprinted name of css/site.css (just css/site.css without --fingerprint)
+            std::string key = strip(lname.substr(rootSegLen + 1), '\\');
+            std::string hashed;
+            if (sitix -> assets.resolve(key, hashed)) { // if it isn't a file, fall through: maybe there's an actual assets directory that knows what this means
+                // the name changes when the asset does, so this page has to be rendered again
+                if (!watched) {
+                    sitix -> watcher.depend(sitix -> watcher.filewatch(sitix -> transmuted(key)), sitix -> watcher.filewatch(sitix -> transmuted(walkToFile() -> name)));
+                }
+                TextBlob* hashedContent = new TextBlob(sitix);
+                hashedContent -> data = hashed;
+                Object* assetObj = new Object(sitix);
+                assetObj -> virile = false;
+                assetObj -> addChild(hashedContent);
+                addChild(assetObj); // we're the root scope, so we own it, same as loaded files
+                return assetObj;
+            }
         }
         FileMan::PathState state = sitix -> checkPath(root);
         std::string directoryName = sitix -> transmuted(root); // the filename relative to the current working directory
         if (state == FileMan::PathState::Directory) {
             Object* dirObject = new Object(sitix);
-            DIR* directory = opendir(directoryName.c_str());
-            struct dirent* entry;
-            while ((entry = readdir(directory)) != NULL) {
-                if (entry -> d_name[0] == '.') { // . and ..
-                    continue;
-                }
-                char* transmuteNamep1 = transmuted("", root.c_str(), entry -> d_name);
+            for (std::string& entry : sitix -> listDirectory(root)) { // comes out of the file index, sorted, so no opendir here
+                char* transmuteNamep1 = transmuted("", root.c_str(), entry.c_str());
                 std::string transmuteName = escapeString(transmuteNamep1, '.');
                 free(transmuteNamep1);
                 Object* enumerated = new Object(sitix);
@@ -155,11 +174,12 @@ Object* Object::lookup(std::string& lname, Object* nope) { // lookup an object b
                 // I imagine this is what doing marijuana feels like
                 // 'cause, yk, it's all connected, *maaaaan*
             }
-            closedir(directory);
             dirObject -> namingScheme = Object::NamingScheme::Named;
             dirObject -> name = root;
             addChild(dirObject);// DON'T free root, because it was passed into the dirObject
-            sitix -> watcher.dirwatch(sitix -> transmuted(root)) -> addDep(sitix -> watcher.filewatch(sitix -> transmuted(walkToFile() -> name)));
+            if (!watched) {
+                sitix -> watcher.depend(sitix -> watcher.dirwatch(sitix -> transmuted(root)), sitix -> watcher.filewatch(sitix -> transmuted(walkToFile() -> name)));
+            }
             if (rootSegLen == lname.size()) {
                 return dirObject;
             }
@@ -168,6 +188,17 @@ Object* Object::lookup(std::string& lname, Object* nope) { // lookup an object b
             }
         }
         else if (state == FileMan::PathState::File) {
+            if (!watched) {
+                sitix -> watcher.depend(sitix -> watcher.filewatch(sitix -> transmuted(root)), sitix -> watcher.filewatch(sitix -> transmuted(walkToFile() -> name)));
+            }
+
+            Object* cached = sitix -> parses.get(directoryName); // every page that uses this template would otherwise parse it all over again
+            if (cached != NULL && cached -> name == root) {
+                addChild(cached);
+                return cached;
+            }
+            delete cached; // (if it's not NULL, it's the same file spelled differently, like /header.stx and header.stx; its filename object would be wrong)
+
             // construct the "filename" object inside loaded files
             // TODO: add a truncated filename object inside the loaded file, which would contain "mod1.html" rather than
             // "templates/modules/mod1.html", for instance.
@@ -178,14 +209,13 @@ Object* Object::lookup(std::string& lname, Object* nope) { // lookup an object b
             fNameObj -> namingScheme = Object::NamingScheme::Named;
             fNameObj -> name = "filename";
             fNameObj -> addChild(fNameContent);
-            
-            sitix -> watcher.filewatch(sitix -> transmuted(root)) -> addDep(sitix -> watcher.filewatch(sitix -> transmuted(walkToFile() -> name)));
 
             MapView map = sitix -> open(directoryName);
             if (!map.isValid()) {
                 printf(ERROR "Invalid map!\n");
                 return NULL;
             }
+            Stats::Time parseStart = Stats::now();
 
             // put together the actual file object, store it on global, and return it
             Object* fileObj = new Object(sitix);
@@ -205,6 +235,10 @@ Object* Object::lookup(std::string& lname, Object* nope) { // lookup an object b
                 content -> fileflags.sitix = false;
                 fileObj -> addChild(content);
             }
+            if (sitix -> stats.enabled) {
+                sitix -> stats.parse.record(Stats::since(parseStart));
+            }
+            sitix -> parses.put(directoryName, fileObj);
             addChild(fileObj); // since we're the global scope, we should add the file to us.
             // the goal is to create an illusion that the entire directory structure is a cohesive part of the object tree
             // and then sorta just load files when they ask us to
@@ -429,4 +463,21 @@ Object* Object::newGhost() {
     Object* ret = new Object(sitix);
     ret -> setGhost(this, true);
     return ret;
-}
\ No newline at end of file
+}
+
+Node* Object::clone() {
+    Object* ret = new Object(sitix);
+    ret -> fileflags = fileflags;
+    ret -> isTemplate = isTemplate;
+    ret -> isFile = isFile;
+    ret -> highestEnumerated = highestEnumerated;
+    ret -> ghost = ghost;
+    ret -> virile = virile;
+    ret -> name = name;
+    ret -> number = number;
+    ret -> namingScheme = namingScheme;
+    for (Node* child : children) {
+        ret -> addChild(child -> clone());
+    }
+    return ret;
+}
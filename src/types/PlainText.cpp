@@ -13,4 +13,10 @@ void PlainText::render(SitixWriter* stream, Object* scope, bool dereference) {
 void PlainText::pTree(int tabLevel) { // replacing debugPrint because it's much more usefulicious
     for (int x = 0; x < tabLevel; x ++) {printf("\t");}
     printf("Text content %d\n", this);
-}
\ No newline at end of file
+}
+
+Node* PlainText::clone() {
+    PlainText* ret = new PlainText(*this);
+    ret -> parent = NULL;
+    return ret;
+}
@@ -29,4 +29,11 @@ void RedirectorStatement::render(SitixWriter*, Object* scope, bool dereference)
     delete result;
     SitixWriter writer(file);
     object -> render(&writer, scope, true);
-}
\ No newline at end of file
+}
+
+Node* RedirectorStatement::clone() {
+    RedirectorStatement* ret = new RedirectorStatement(*this);
+    ret -> parent = NULL;
+    ret -> object = (Object*)object -> clone();
+    return ret;
+}
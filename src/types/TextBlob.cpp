@@ -13,4 +13,10 @@ void TextBlob::render(SitixWriter* out, Object* scope, bool dereference) {
 void TextBlob::pTree(int tabLevel) { // replacing debugPrint because it's much more usefulicious
     for (int x = 0; x < tabLevel; x ++) {printf("\t");}
     printf("Text content %d\n", this);
-}
\ No newline at end of file
+}
+
+Node* TextBlob::clone() {
+    TextBlob* ret = new TextBlob(*this);
+    ret -> parent = NULL;
+    return ret;
+}
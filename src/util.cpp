@@ -81,6 +81,22 @@ std::string escapeString(std::string thing, char toEscape) {
     return ret;
 }
 
+std::string escapeHTML(std::string thing) {
+    std::string ret;
+    ret.reserve(thing.size());
+    for (char c : thing) {
+        switch (c) {
+            case '&': ret += "&amp;"; break;
+            case '<': ret += "&lt;"; break;
+            case '>': ret += "&gt;"; break;
+            case '"': ret += "&quot;"; break;
+            case '\'': ret += "&#39;"; break;
+            default: ret += c;
+        }
+    }
+    return ret;
+}
+
 
 char* truncatn(const char* thing, size_t n, char stop) { // backwards-truncate the end of a string of known length to the last `stop` character
     // (so truncatn("hello, world", 12, ',') == " world")
@@ -212,6 +228,22 @@ void rmrf(const char* path) {
     nftw(path, iterRemove, 64, FTW_DEPTH);
 }
 
+std::vector<std::string> split(std::string thing, char delimiter) {
+    std::vector<std::string> ret;
+    size_t start = 0;
+    while (start <= thing.size()) {
+        size_t end = thing.find(delimiter, start);
+        if (end == std::string::npos) {
+            end = thing.size();
+        }
+        if (end > start) {
+            ret.push_back(thing.substr(start, end - start));
+        }
+        start = end + 1;
+    }
+    return ret;
+}
+
 std::string trim2dir(std::string dir) {
     size_t i = dir.size() - 1;
     while (i > 0 && dir[i - 1] != '/') {
@@ -0,0 +1,874 @@
+// definitions for WriteBehind
+
+#include <writebehind.hpp>
+#include <tarwriter.hpp>
+#include <fcntl.h>
+#include <unistd.h>
+#include <sys/stat.h>
+#include <cerrno>
+#include <cstring>
+#include <sys/uio.h>
+#include <sys/sendfile.h>
+#include <sys/ioctl.h>
+#include <linux/fs.h>
+#include <climits>
+
+
+const char* OutputSegment::data() {
+    return view.has_value() ? view -> cbuf() : bytes.c_str();
+}
+
+size_t OutputSegment::size() {
+    return view.has_value() ? view -> len() : bytes.size();
+}
+
+
+OutputFile* WriteBehind::open(std::string path) {
+    OutputFile* file = new OutputFile;
+    file -> path = path;
+    file -> compress = precompress.wants(path);
+    submit(OutputJob { .op = OutputJob::Open, .file = file });
+    return file;
+}
+
+void WriteBehind::write(OutputFile* file, std::vector<OutputSegment>&& segments) {
+    if (segments.size() == 0) {
+        return;
+    }
+    size_t owned = 0;
+    for (OutputSegment& segment : segments) {
+        if (!segment.view.has_value()) {
+            owned += segment.bytes.size();
+        }
+    }
+    submit(OutputJob { .op = OutputJob::Write, .file = file, .segments = std::move(segments), .owned = owned });
+}
+
+void WriteBehind::close(OutputFile* file) {
+    submit(OutputJob { .op = OutputJob::Close, .file = file });
+}
+
+void WriteBehind::remove(std::string path) {
+    submit(OutputJob { .op = OutputJob::Remove, .data = path });
+}
+
+void WriteBehind::submit(OutputJob job) {
+    size_t size = job.owned;
+    {
+        std::unique_lock<std::mutex> lock(m_mutex);
+        if (!worker.joinable()) { // lazily start the thread, so FileMans that never write anything (like the input) don't get one
+            worker = std::thread(&WriteBehind::run, this);
+        }
+        // if nothing is in flight we let it through no matter how big it is, otherwise a single huge buffer would wait forever
+        progress.wait(lock, [&]{ return inflight == 0 || inflight + size <= maxInflight; });
+        inflight += size;
+        jobs.push_back(std::move(job));
+    }
+    wake.notify_one();
+}
+
+void WriteBehind::copy(std::string from, std::string to) {
+    if (archive != NULL) { // an archive is one sequential stream, so copies have to take their turn with everything else on the writer thread
+        OutputFile* file = new OutputFile;
+        file -> path = to;
+        submit(OutputJob { .op = OutputJob::Copy, .file = file, .data = from });
+        return;
+    }
+    copiers.submit([this, from, to]{ copyFile(from, to); });
+}
+
+void WriteBehind::copyFile(std::string from, std::string to) {
+    int in = ::open(from.c_str(), O_RDONLY | O_CLOEXEC);
+    struct stat sb;
+    if (in == -1 || fstat(in, &sb) != 0) {
+        error("Couldn't open " + from + " for copying (" + strerror(errno) + ").");
+        if (in != -1) {
+            ::close(in);
+        }
+        return;
+    }
+    OutputFile file;
+    file.path = to;
+    if (!locate(&file)) {
+        ::close(in);
+        return;
+    }
+    // we never read passthrough files, so instead of their contents, fingerprint the source's identity and modification time
+    Hasher signature;
+    signature.update(&sb.st_dev, sizeof(sb.st_dev));
+    signature.update(&sb.st_ino, sizeof(sb.st_ino));
+    signature.update(&sb.st_size, sizeof(sb.st_size));
+    signature.update(&sb.st_mtim, sizeof(sb.st_mtim));
+    signature.update(&linkMode, sizeof(linkMode));
+    bool compress = precompress.wants(to);
+    if (manifest.enabled) {
+        file.recorded = true;
+        if (manifest.record(to, signature.digest()) && reuse(&file)) {
+            ::close(in);
+            finish(&file);
+            if (compress) {
+                siblings(to, signature.digest(), sb.st_size, std::make_shared<std::vector<OutputSegment>>(), from);
+            }
+            return;
+        }
+    }
+    if (linkMode == Hardlink) { // same dance as publish(): link beside the real name and rename over it, so the old copy is never missing
+        std::string temp = tempName(file.name);
+        unlinkat(file.dir, temp.c_str(), 0); // leftovers from a crashed build
+        if (linkat(AT_FDCWD, from.c_str(), file.dir, temp.c_str(), 0) == 0) {
+            if (renameat(file.dir, temp.c_str(), file.dir, file.name.c_str()) != 0) {
+                error("Couldn't publish output file " + to + " (" + strerror(errno) + ").");
+                unlinkat(file.dir, temp.c_str(), 0);
+                manifest.forget(to);
+                compress = false;
+            }
+            ::close(in);
+            finish(&file);
+            if (compress) {
+                siblings(to, signature.digest(), sb.st_size, std::make_shared<std::vector<OutputSegment>>(), from);
+            }
+            return;
+        } // probably EXDEV (input and output are on different filesystems), so just copy it
+    }
+    if (!openTemp(&file)) {
+        error("Couldn't open output file " + to + " (" + strerror(errno) + "). This file will not be copied.");
+        manifest.forget(to);
+        ::close(in);
+        finish(&file);
+        return;
+    }
+    int out = file.fd;
+    if (linkMode == Reflink && ioctl(out, FICLONE, in) == 0) {
+        ::close(in);
+        finish(&file);
+        if (compress) {
+            siblings(to, signature.digest(), sb.st_size, std::make_shared<std::vector<OutputSegment>>(), from);
+        }
+        return;
+    }
+    off_t left = transfer(in, out, sb.st_size);
+    if (left > 0) {
+        error("Couldn't copy " + from + " to " + to + " (" + strerror(errno) + "). It will not be published.");
+        manifest.forget(to);
+        file.failed = true;
+    }
+    ::close(in);
+    bool copied = !file.failed;
+    finish(&file);
+    if (copied && compress) {
+        siblings(to, signature.digest(), sb.st_size, std::make_shared<std::vector<OutputSegment>>(), from);
+    }
+}
+
+off_t WriteBehind::transfer(int in, int out, off_t left) {
+    // all three of these advance the file offsets of in and out, so if one gives up partway through the next picks up where it left off
+    while (left > 0) {
+        ssize_t r = copy_file_range(in, NULL, out, NULL, left, 0);
+        if (r <= 0) {
+            break; // EXDEV on older kernels, ENOSYS, EINVAL on some filesystems... sendfile will probably work
+        }
+        left -= r;
+    }
+    while (left > 0) {
+        ssize_t r = sendfile(out, in, NULL, left);
+        if (r <= 0) {
+            break;
+        }
+        left -= r;
+    }
+    char buffer[64 * 1024];
+    while (left > 0) {
+        ssize_t r = ::read(in, buffer, sizeof(buffer));
+        if (r == -1 && errno == EINTR) {
+            continue;
+        }
+        if (r <= 0) {
+            break;
+        }
+        ssize_t done = 0;
+        while (done < r) {
+            ssize_t w = ::write(out, buffer + done, r - done);
+            if (w == -1 && errno == EINTR) {
+                continue;
+            }
+            if (w == -1) {
+                break;
+            }
+            done += w;
+        }
+        if (done < r) {
+            break;
+        }
+        left -= r;
+    }
+    return left;
+}
+
+void WriteBehind::error(std::string message) {
+    std::lock_guard<std::mutex> lock(m_mutex);
+    errors.push_back(message);
+}
+
+std::vector<std::string> WriteBehind::drain() {
+    copiers.wait();
+    {
+        std::unique_lock<std::mutex> lock(m_mutex);
+        progress.wait(lock, [&]{ return jobs.size() == 0 && !busy; });
+    }
+    precompress.wait(); // the writer hands these off as it closes files, so only once it's idle do we know they've all been handed off
+    std::lock_guard<std::mutex> lock(m_mutex);
+    std::vector<std::string> ret;
+    ret.swap(errors);
+    return ret;
+}
+
+void WriteBehind::run() {
+    IoUring& ring = IoUring::local();
+    bool batched = archive == NULL && ring.init() && ring.supports({ IORING_OP_OPENAT, IORING_OP_WRITEV, IORING_OP_CLOSE });
+    std::deque<OutputJob> batch;
+    while (true) {
+        {
+            std::unique_lock<std::mutex> lock(m_mutex);
+            busy = false;
+            progress.notify_all();
+            wake.wait(lock, [&]{ return stopping || jobs.size() > 0; });
+            if (jobs.size() == 0) { // stopping, and there's nothing left to do
+                return;
+            }
+            batch.swap(jobs); // take everything that's queued in one go, so we aren't fighting renderers for the lock on every job
+            busy = true;
+        }
+        if (batched) {
+            size_t start = 0;
+            while (start < batch.size()) {
+                start = performBatch(ring, batch, start);
+            }
+            batch.clear();
+            continue;
+        }
+        for (OutputJob& job : batch) {
+            perform(job);
+            if (job.op == OutputJob::Write) {
+                std::lock_guard<std::mutex> lock(m_mutex);
+                inflight -= job.owned;
+                progress.notify_all();
+            }
+        }
+        batch.clear();
+    }
+}
+
+void WriteBehind::perform(OutputJob& job) {
+    OutputFile* file = job.file;
+    if (archive != NULL) {
+        performArchive(job);
+        return;
+    }
+    if (job.op == OutputJob::Open) {
+        if (locate(file) && !openTemp(file)) {
+            file -> failed = true;
+            error("Couldn't open output file " + file -> path + " (" + strerror(errno) + "). This file will not be rendered.");
+        }
+    }
+    else if (job.op == OutputJob::Write) {
+        if (file -> failed) {
+            return;
+        }
+        std::vector<struct iovec> iov;
+        iov.reserve(job.segments.size());
+        for (OutputSegment& segment : job.segments) {
+            if (segment.size() > 0) {
+                iov.push_back(iovec { .iov_base = (void*)segment.data(), .iov_len = segment.size() });
+                file -> hash.update(segment.data(), segment.size());
+            }
+        }
+        size_t at = 0; // first iovec that hasn't been fully written
+        while (at < iov.size()) {
+            int count = iov.size() - at > IOV_MAX ? IOV_MAX : iov.size() - at;
+            ssize_t r = ::pwritev(file -> fd, iov.data() + at, count, file -> offset);
+            if (r == -1 && errno == EINTR) {
+                continue;
+            }
+            if (r == -1) {
+                file -> failed = true;
+                error("Couldn't write to output file " + file -> path + " (" + strerror(errno) + "). It will be incomplete.");
+                return;
+            }
+            file -> offset += r;
+            while (r > 0) { // skip past whatever got written, which may end partway through an iovec
+                if ((size_t)r >= iov[at].iov_len) {
+                    r -= iov[at].iov_len;
+                    at ++;
+                }
+                else {
+                    iov[at].iov_base = (char*)iov[at].iov_base + r;
+                    iov[at].iov_len -= r;
+                    r = 0;
+                }
+            }
+        }
+        keep(file, job.segments);
+    }
+    else if (job.op == OutputJob::Close) {
+        finish(file);
+        delete file;
+    }
+    else if (job.op == OutputJob::Remove) {
+        if (::remove(job.data.c_str()) != 0 && errno != ENOENT) {
+            error("Couldn't remove " + job.data + " (" + strerror(errno) + ").");
+        }
+        else {
+            forget(job.data);
+            manifest.forget(job.data);
+        }
+    }
+}
+
+void WriteBehind::keep(OutputFile* file, std::vector<OutputSegment>& segments) {
+    if (!file -> compress || file -> failed) {
+        return;
+    }
+    for (OutputSegment& segment : segments) {
+        file -> held.push_back(std::move(segment));
+    }
+    segments.clear();
+}
+
+void WriteBehind::siblings(OutputFile* file) {
+    if (!file -> compress) {
+        return;
+    }
+    std::shared_ptr<std::vector<OutputSegment>> data = std::make_shared<std::vector<OutputSegment>>(std::move(file -> held));
+    file -> held.clear();
+    siblings(file -> path, file -> hash.digest(), file -> offset, data, "");
+}
+
+void WriteBehind::siblings(std::string path, uint64_t source, size_t size, std::shared_ptr<std::vector<OutputSegment>> data, std::string from) {
+    std::vector<Precompressor::Format> needed;
+    for (Precompressor::Format format : precompress.formats) {
+        OutputFile sibling;
+        sibling.path = path + Precompressor::suffix(format);
+        if (!locate(&sibling)) {
+            continue;
+        }
+        if (size < precompress.minSize) { // it might not always have been this small, and a stale sibling would get served instead of the real thing
+            unlinkat(sibling.dir, sibling.name.c_str(), 0);
+            manifest.forget(sibling.path);
+        }
+        else if (manifest.enabled) { // a sibling is a pure function of the file it's compressed from, so if that hasn't changed, neither has it
+            Hasher signature;
+            signature.update(&source, sizeof(source));
+            signature.update(&format, sizeof(format));
+            signature.update(&precompress.fast, sizeof(precompress.fast)); // (so a normal build redoes what -w compressed quickly)
+            if (!manifest.record(sibling.path, signature.digest()) || !reuse(&sibling)) {
+                needed.push_back(format);
+            }
+        }
+        else {
+            needed.push_back(format);
+        }
+        finish(&sibling);
+    }
+    if (needed.size() == 0) {
+        return;
+    }
+    precompress.submit(size, [this, data, path, from, size, needed]{
+        if (data -> size() == 0 && from.size() > 0) { // a passthrough copy: compress straight from the input
+            if (mappedSpans) {
+                data -> push_back(OutputSegment { .view = MapView(from) });
+            }
+            else { // (read, not mapped: it might be edited while we're compressing it)
+                ReadArena arena;
+                data -> push_back(OutputSegment { .view = MapView(from, NULL, SIZE_MAX, &arena) });
+            }
+        }
+        for (Precompressor::Format format : needed) {
+            std::string compressed;
+            OutputFile sibling;
+            sibling.path = path + Precompressor::suffix(format);
+            sibling.recorded = true; // (by siblings(), if the manifest is on)
+            if (!locate(&sibling)) {
+                continue;
+            }
+            if ((from.size() > 0 && !data -> at(0).view -> isValid()) || !precompress.compress(format, *data, compressed)) {
+                error("Couldn't compress " + sibling.path + ".");
+                manifest.forget(sibling.path);
+                finish(&sibling);
+                continue;
+            }
+            if (compressed.size() >= size - size / 20) { // less than 5% smaller isn't worth the server's time (or ours)
+                unlinkat(sibling.dir, sibling.name.c_str(), 0);
+                manifest.forget(sibling.path);
+                finish(&sibling);
+                continue;
+            }
+            if (!openTemp(&sibling)) {
+                error("Couldn't open output file " + sibling.path + " (" + strerror(errno) + ").");
+                manifest.forget(sibling.path);
+                finish(&sibling);
+                continue;
+            }
+            size_t done = 0;
+            while (done < compressed.size()) {
+                ssize_t r = ::write(sibling.fd, compressed.data() + done, compressed.size() - done);
+                if (r == -1 && errno == EINTR) {
+                    continue;
+                }
+                if (r == -1) {
+                    error("Couldn't write to output file " + sibling.path + " (" + strerror(errno) + ").");
+                    manifest.forget(sibling.path);
+                    sibling.failed = true;
+                    break;
+                }
+                done += r;
+            }
+            finish(&sibling);
+        }
+        precompress.done(size);
+    });
+}
+
+void WriteBehind::performArchive(OutputJob& job) {
+    OutputFile* file = job.file;
+    if (job.op == OutputJob::Write) { // tar needs the size up front, so hang on to everything until the file is closed
+        for (OutputSegment& segment : job.segments) {
+            file -> held.push_back(std::move(segment));
+        }
+    }
+    else if (job.op == OutputJob::Close) {
+        archive -> add(file -> path, file -> held);
+        size_t size = 0;
+        for (OutputSegment& segment : file -> held) {
+            size += segment.size();
+        }
+        if (file -> compress && size >= precompress.minSize) { // done right here, rather than on the pool, to keep the archive's order fixed
+            for (Precompressor::Format format : precompress.formats) {
+                std::vector<OutputSegment> compressed(1);
+                if (precompress.compress(format, file -> held, compressed[0].bytes) && compressed[0].bytes.size() < size - size / 20) {
+                    archive -> add(file -> path + Precompressor::suffix(format), compressed);
+                }
+            }
+        }
+        delete file;
+    }
+    else if (job.op == OutputJob::Copy) {
+        int in = ::open(job.data.c_str(), O_RDONLY | O_CLOEXEC);
+        struct stat sb;
+        if (in == -1 || fstat(in, &sb) != 0) {
+            error("Couldn't open " + job.data + " for copying (" + strerror(errno) + ").");
+        }
+        else {
+            archive -> addFile(file -> path, in, sb.st_size);
+        }
+        if (in != -1) {
+            ::close(in);
+        }
+        delete file;
+    }
+    // Open has nothing to do, and Remove can't happen: there's no taking things back out of a stream (main() doesn't allow watch mode with archives)
+}
+
+size_t WriteBehind::performBatch(IoUring& ring, std::deque<OutputJob>& batch, size_t start) {
+    // does the same thing as calling perform() on each job, but as three ring submissions (every open, then every write, then every close) instead
+    // of three-plus syscalls per file. Jobs for different files don't care about each other's order, and jobs for the same file keep theirs because
+    // opens all finish before any write is submitted, writes carry explicit offsets, and closes wait for the writes.
+    // A Remove, or a second Open of a path we've already opened, has to stay in order with everything around it, so the run stops there.
+    // Returns the index of the first job it didn't do.
+    size_t end = start;
+    std::unordered_set<std::string> opening;
+    std::vector<OutputFile*> opens;
+    std::vector<OutputJob*> writes;
+    std::vector<OutputJob*> closes;
+    while (end < batch.size()) {
+        OutputJob& job = batch[end];
+        if (job.op == OutputJob::Remove) {
+            if (end == start) { // nothing queued up in front of it, so just do it now
+                perform(job);
+                end ++;
+            }
+            break;
+        }
+        if (job.op == OutputJob::Open) {
+            if (opening.contains(job.file -> path) || opens.size() == maxBatchFiles) {
+                break;
+            }
+            opening.insert(job.file -> path);
+            if (locate(job.file)) { // the directory fd is cached, so this is usually free
+                opens.push_back(job.file);
+            }
+        }
+        else if (job.op == OutputJob::Write) {
+            writes.push_back(&job);
+        }
+        else {
+            closes.push_back(&job);
+        }
+        end ++;
+    }
+
+    std::vector<int> results;
+    bool anonymous = tmpfiles;
+    ring.batch(opens.size(), [&](struct io_uring_sqe* sqe, size_t i) {
+        sqe -> opcode = IORING_OP_OPENAT;
+        sqe -> fd = opens[i] -> dir;
+        if (anonymous) {
+            sqe -> addr = (unsigned long)".";
+            sqe -> open_flags = O_TMPFILE | O_RDWR | O_CLOEXEC; // readable for publish()'s fallback, as in openTemp()
+        }
+        else {
+            opens[i] -> temp = tempName(opens[i] -> name);
+            sqe -> addr = (unsigned long)opens[i] -> temp.c_str();
+            sqe -> open_flags = O_WRONLY | O_CREAT | O_TRUNC | O_CLOEXEC;
+        }
+        sqe -> len = 0770;
+    }, results);
+    for (size_t i = 0; i < opens.size(); i ++) {
+        if (results[i] >= 0) {
+            opens[i] -> fd = results[i];
+            fchmod(results[i], 0770); // rw for user and group, regardless of umask (which is process-wide, so we can't just clear it here)
+        }
+        else if (!openTemp(opens[i])) { // the synchronous path knows how to fall back from O_TMPFILE, and sets errno for us
+            opens[i] -> failed = true;
+            error("Couldn't open output file " + opens[i] -> path + " (" + strerror(errno) + "). This file will not be rendered.");
+        }
+    }
+
+    struct Chunk { // one writev sqe: a run of at most IOV_MAX iovecs out of a job
+        OutputJob* job;
+        size_t first; // index into iov
+        int count;
+        off_t offset;
+    };
+    std::vector<struct iovec> iov;
+    std::vector<Chunk> chunks;
+    for (OutputJob* job : writes) {
+        OutputFile* file = job -> file;
+        if (file -> failed) {
+            continue;
+        }
+        for (OutputSegment& segment : job -> segments) {
+            if (segment.size() == 0) {
+                continue;
+            }
+            if (chunks.size() == 0 || chunks.back().job != job || chunks.back().count == IOV_MAX) {
+                chunks.push_back(Chunk { job, iov.size(), 0, file -> offset });
+            }
+            iov.push_back(iovec { .iov_base = (void*)segment.data(), .iov_len = segment.size() });
+            file -> hash.update(segment.data(), segment.size());
+            chunks.back().count ++;
+            file -> offset += segment.size();
+        }
+    }
+    ring.batch(chunks.size(), [&](struct io_uring_sqe* sqe, size_t i) {
+        sqe -> opcode = IORING_OP_WRITEV;
+        sqe -> fd = chunks[i].job -> file -> fd;
+        sqe -> addr = (unsigned long)(iov.data() + chunks[i].first);
+        sqe -> len = chunks[i].count;
+        sqe -> off = chunks[i].offset;
+    }, results);
+    for (size_t i = 0; i < chunks.size(); i ++) {
+        Chunk& chunk = chunks[i];
+        OutputFile* file = chunk.job -> file;
+        if (file -> failed) { // an earlier chunk of this file already went wrong
+            continue;
+        }
+        if (results[i] < 0) {
+            file -> failed = true;
+            error("Couldn't write to output file " + file -> path + " (" + strerror(-results[i]) + "). It will be incomplete.");
+            continue;
+        }
+        size_t done = results[i];
+        size_t at = chunk.first;
+        size_t last = chunk.first + chunk.count;
+        off_t offset = chunk.offset + done;
+        while (true) { // a short write (full disc, signal...) is rare enough that finishing it synchronously is fine
+            while (done > 0) { // skip past whatever got written, which may end partway through an iovec
+                if (done >= iov[at].iov_len) {
+                    done -= iov[at].iov_len;
+                    at ++;
+                }
+                else {
+                    iov[at].iov_base = (char*)iov[at].iov_base + done;
+                    iov[at].iov_len -= done;
+                    done = 0;
+                }
+            }
+            if (at == last) {
+                break;
+            }
+            ssize_t r = ::pwritev(file -> fd, iov.data() + at, last - at, offset);
+            if (r == -1 && errno == EINTR) {
+                continue;
+            }
+            if (r == -1) {
+                file -> failed = true;
+                error("Couldn't write to output file " + file -> path + " (" + strerror(errno) + "). It will be incomplete.");
+                break;
+            }
+            done = r;
+            offset += r;
+        }
+    }
+
+    for (OutputJob* job : writes) {
+        keep(job -> file, job -> segments);
+    }
+
+    std::vector<OutputFile*> closing;
+    for (OutputJob* job : closes) {
+        OutputFile* file = job -> file;
+        if (file -> fd == -1) {
+            finish(file); // nothing to close, but it might still have an uncached directory fd
+            continue;
+        }
+        if (!file -> failed && !unchanged(file)) {
+            publish(file); // linkat/renameat, synchronously. They're only one or two syscalls and they have to come after the writes anyway.
+        }
+        else if (file -> temp.size() > 0) {
+            unlinkat(file -> dir, file -> temp.c_str(), 0);
+        }
+        if (!file -> failed) {
+            siblings(file);
+        }
+        closing.push_back(file);
+    }
+    ring.batch(closing.size(), [&](struct io_uring_sqe* sqe, size_t i) {
+        sqe -> opcode = IORING_OP_CLOSE;
+        sqe -> fd = closing[i] -> fd;
+    }, results);
+    for (size_t i = 0; i < closing.size(); i ++) {
+        if (results[i] < 0 && !closing[i] -> failed) {
+            error("Couldn't finish writing output file " + closing[i] -> path + " (" + strerror(-results[i]) + ").");
+        }
+    }
+    for (OutputFile* file : closing) {
+        if (file -> ownsDir) {
+            ::close(file -> dir);
+        }
+    }
+    for (OutputJob* job : closes) {
+        delete job -> file;
+    }
+
+    size_t written = 0;
+    for (OutputJob* job : writes) {
+        written += job -> owned;
+        job -> segments.clear(); // let go of the input mappings now rather than when the whole batch is cleared
+    }
+    if (written > 0) {
+        std::lock_guard<std::mutex> lock(m_mutex);
+        inflight -= written;
+        progress.notify_all();
+    }
+    return end;
+}
+
+int WriteBehind::directory(std::string path, bool& owned) {
+    owned = false;
+    while (path.size() > 1 && path.back() == '/') {
+        path.pop_back();
+    }
+    if (path.size() == 0) {
+        return AT_FDCWD;
+    }
+    {
+        std::lock_guard<std::mutex> lock(dirMutex);
+        auto cached = dirFds.find(path);
+        if (cached != dirFds.end()) { // the common case: every file after the first in a directory stops here, without a single syscall
+            return cached -> second;
+        }
+    }
+    size_t slash = path.rfind('/');
+    std::string parentPath = slash == std::string::npos || path == "/" ? "" : path.substr(0, slash == 0 ? 1 : slash);
+    std::string name = slash == std::string::npos || path == "/" ? path : path.substr(slash + 1);
+    bool parentOwned;
+    int parent = directory(parentPath, parentOwned);
+    if (parent == -1) {
+        return -1;
+    }
+    int made = 0;
+    if (mkdirat(parent, name.c_str(), 0755) == 0) {
+        fchmodat(parent, name.c_str(), 0755, 0); // regardless of umask
+    }
+    else if (errno != EEXIST) {
+        made = errno;
+    }
+    int fd = openat(parent, name.c_str(), O_RDONLY | O_DIRECTORY | O_CLOEXEC); // this also tells us if something that isn't a directory is in the way
+    if (parentOwned) {
+        ::close(parent);
+    }
+    if (fd == -1) {
+        error("Couldn't create directory " + path + " (" + strerror(made != 0 ? made : errno) + ").");
+        return -1;
+    }
+    std::lock_guard<std::mutex> lock(dirMutex);
+    auto cached = dirFds.find(path);
+    if (cached != dirFds.end()) { // another thread beat us to it
+        ::close(fd);
+        return cached -> second;
+    }
+    if (dirFds.size() >= maxDirFds) { // too many directories to keep them all open. The caller has to close this one.
+        owned = true;
+        return fd;
+    }
+    dirFds[path] = fd;
+    return fd;
+}
+
+void WriteBehind::forget(std::string path) {
+    // only ever called for paths we just removed, which means an empty directory at most, so nobody is in the middle of using its fd
+    std::lock_guard<std::mutex> lock(dirMutex);
+    for (auto it = dirFds.begin(); it != dirFds.end();) {
+        if (it -> first == path || (it -> first.size() > path.size() && it -> first.starts_with(path) && it -> first[path.size()] == '/')) {
+            ::close(it -> second);
+            it = dirFds.erase(it);
+        }
+        else {
+            it ++;
+        }
+    }
+}
+
+std::string WriteBehind::tempName(std::string name) {
+    return "." + name + ".sitix-tmp";
+}
+
+bool WriteBehind::locate(OutputFile* file) {
+    size_t slash = file -> path.rfind('/');
+    if (slash == std::string::npos) {
+        file -> name = file -> path;
+        file -> dir = directory("", file -> ownsDir);
+    }
+    else {
+        file -> name = file -> path.substr(slash + 1);
+        file -> dir = directory(file -> path.substr(0, slash == 0 ? 1 : slash), file -> ownsDir);
+    }
+    if (file -> dir == -1) {
+        file -> failed = true; // directory() already complained
+        return false;
+    }
+    return true;
+}
+
+bool WriteBehind::openTemp(OutputFile* file) {
+    if (tmpfiles) {
+        file -> fd = openat(file -> dir, ".", O_TMPFILE | O_RDWR | O_CLOEXEC, 0770); // readable, in case publish() has to copy it out
+        if (file -> fd == -1 && (errno == EOPNOTSUPP || errno == EISDIR || errno == EINVAL)) {
+            tmpfiles = false; // this filesystem (or kernel) doesn't do O_TMPFILE. It won't start doing it later, either.
+        }
+    }
+    if (!tmpfiles) {
+        file -> temp = tempName(file -> name);
+        file -> fd = openat(file -> dir, file -> temp.c_str(), O_WRONLY | O_CREAT | O_TRUNC | O_CLOEXEC, 0770);
+    }
+    if (file -> fd == -1) {
+        return false;
+    }
+    fchmod(file -> fd, 0770); // rw for user and group, regardless of umask
+    // todo: sane permission inheritance (ACL doohickey?)
+    return true;
+}
+
+void WriteBehind::publish(OutputFile* file) {
+    if (file -> temp.size() == 0) { // anonymous: give it a name. linkat refuses to replace anything, so if the name is taken, link to a temporary and rename over.
+        char proc[64];
+        snprintf(proc, sizeof(proc), "/proc/self/fd/%d", file -> fd);
+        if (linkat(AT_FDCWD, proc, file -> dir, file -> name.c_str(), AT_SYMLINK_FOLLOW) == 0) {
+            return;
+        }
+        if (errno != EEXIST) { // no /proc (a chroot, or a bare container). Everything from now on gets a name up front, and this one gets a
+            // named copy: the data only exists in the anonymous inode, and without /proc there's no way to link that.
+            tmpfiles = false;
+            std::string temp = tempName(file -> name);
+            int named = openat(file -> dir, temp.c_str(), O_WRONLY | O_CREAT | O_TRUNC | O_CLOEXEC, 0770);
+            struct stat sb;
+            if (named == -1 || fstat(file -> fd, &sb) != 0 || lseek(file -> fd, 0, SEEK_SET) != 0) {
+                error("Couldn't publish output file " + file -> path + " (" + strerror(errno) + ").");
+                if (named != -1) {
+                    ::close(named);
+                    unlinkat(file -> dir, temp.c_str(), 0);
+                }
+                return;
+            }
+            fchmod(named, 0770);
+            if (transfer(file -> fd, named, sb.st_size) > 0) {
+                error("Couldn't publish output file " + file -> path + " (" + strerror(errno) + ").");
+                ::close(named);
+                unlinkat(file -> dir, temp.c_str(), 0);
+                return;
+            }
+            ::close(file -> fd); // the anonymous one just evaporates
+            file -> fd = named;
+            file -> temp = temp;
+            return publish(file);
+        }
+        file -> temp = tempName(file -> name);
+        unlinkat(file -> dir, file -> temp.c_str(), 0); // leftovers from a crashed build
+        if (linkat(AT_FDCWD, proc, file -> dir, file -> temp.c_str(), AT_SYMLINK_FOLLOW) != 0) {
+            error("Couldn't publish output file " + file -> path + " (" + strerror(errno) + ").");
+            file -> temp = "";
+            return;
+        }
+    }
+    if (renameat(file -> dir, file -> temp.c_str(), file -> dir, file -> name.c_str()) != 0) {
+        error("Couldn't publish output file " + file -> path + " (" + strerror(errno) + ").");
+        unlinkat(file -> dir, file -> temp.c_str(), 0);
+    }
+}
+
+bool WriteBehind::unchanged(OutputFile* file) {
+    if (!manifest.enabled || file -> recorded) {
+        return false;
+    }
+    return manifest.record(file -> path, file -> hash.digest()) && reuse(file);
+}
+
+bool WriteBehind::reuse(OutputFile* file) {
+    if (manifest.base.size() == 0) { // building in place: the old copy is right where it needs to be, unless someone deleted it by hand.
+        // That's still one syscall against the three or four a rewrite would cost.
+        return faccessat(file -> dir, file -> name.c_str(), F_OK, AT_SYMLINK_NOFOLLOW) == 0;
+    }
+    // building into a staging generation: share the previous generation's inode instead of writing it again. Nobody ever writes into a published
+    // file (new versions are always new inodes), so the two generations can't step on each other.
+    std::string old = manifest.base + "/" + manifest.key(file -> path);
+    return linkat(AT_FDCWD, old.c_str(), file -> dir, file -> name.c_str(), 0) == 0;
+}
+
+void WriteBehind::finish(OutputFile* file) {
+    if (file -> fd != -1) {
+        if (!file -> failed && !unchanged(file)) {
+            publish(file);
+        }
+        else if (file -> temp.size() > 0) { // a failed (or unneeded) anonymous file just disappears on close, but a named one has to be cleaned up
+            unlinkat(file -> dir, file -> temp.c_str(), 0);
+        }
+        if (::close(file -> fd) != 0 && !file -> failed) {
+            error("Couldn't finish writing output file " + file -> path + " (" + strerror(errno) + ").");
+        }
+        file -> fd = -1;
+        if (!file -> failed) {
+            siblings(file);
+        }
+    }
+    if (file -> ownsDir) {
+        ::close(file -> dir);
+        file -> ownsDir = false;
+    }
+}
+
+WriteBehind::~WriteBehind() {
+    {
+        std::lock_guard<std::mutex> lock(m_mutex);
+        stopping = true;
+    }
+    wake.notify_one();
+    if (worker.joinable()) {
+        worker.join();
+    }
+    copiers.wait();
+    precompress.wait();
+    for (auto& dir : dirFds) {
+        ::close(dir.second);
+    }
+    delete archive;
+}